@@ -252,6 +252,9 @@ static void bfq_bfqq_move(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 {
 	int busy, resume;
 
+	/* Batched service belongs to the old ancestors */
+	bfq_bfqq_flush_service(bfqq);
+
 	busy = bfq_bfqq_busy(bfqq);
 	resume = !RB_EMPTY_ROOT(&bfqq->sort_list);
 
@@ -528,6 +531,7 @@ static void bfq_destroy_group(struct bfqio_cgroup *bgrp, struct bfq_group *bfqg)
  */
 static void bfq_disconnect_groups(struct bfq_data *bfqd)
 {
+	struct bfqio_cgroup *bgrp = &bfqio_root_cgroup;
 	struct hlist_node *pos, *n;
 	struct bfq_group *bfqg;
 
@@ -550,22 +554,29 @@ static void bfq_disconnect_groups(struct bfq_data *bfqd)
 			bfqg) ;
 		bfq_put_async_queues(bfqd, bfqg);
 	}
+
+	/*
+	 * Unlink the root group here, under the queue lock, so that the
+	 * grace period bfq_exit_queue() waits for before freeing bfqd
+	 * also covers RCU walkers of the root cgroup's group list.
+	 */
+	bfqg = bfqd->root_group;
+	spin_lock(&bgrp->lock);
+	hlist_del_rcu(&bfqg->group_node);
+	rcu_assign_pointer(bfqg->bfqd, NULL);
+	spin_unlock(&bgrp->lock);
 }
 
 static inline void bfq_free_root_group(struct bfq_data *bfqd)
 {
-	struct bfqio_cgroup *bgrp = &bfqio_root_cgroup;
 	struct bfq_group *bfqg = bfqd->root_group;
 
 	bfq_put_async_queues(bfqd, bfqg);
 
-	spin_lock_irq(&bgrp->lock);
-	hlist_del_rcu(&bfqg->group_node);
-	spin_unlock_irq(&bgrp->lock);
-
 	/*
-	 * No need to synchronize_rcu() here: since the device is gone
-	 * there cannot be any read-side access to its root_group.
+	 * No need to synchronize_rcu() here: bfq_disconnect_groups()
+	 * unlinked the root group before the grace period waited for in
+	 * bfq_exit_queue().
 	 */
 	kfree(bfqg);
 }
@@ -593,6 +604,85 @@ static struct bfq_group *bfq_alloc_root_group(struct bfq_data *bfqd, int node)
 	return bfqg;
 }
 
+static inline struct bfq_group *bfqq_group(struct bfq_queue *bfqq)
+{
+	return container_of(bfqq->entity.sched_data, struct bfq_group,
+			    sched_data);
+}
+
+static inline void bfq_group_stats_insert(struct request *rq)
+{
+	rq->elevator_private[2] =
+		(void *)(unsigned long)ktime_to_us(ktime_get());
+}
+
+static inline void bfq_group_stats_dispatch(struct bfq_queue *bfqq,
+					    struct request *rq)
+{
+	bfqq_group(bfqq)->stats.sectors += blk_rq_sectors(rq);
+}
+
+static inline void bfq_group_stats_complete(struct bfq_queue *bfqq,
+					    struct request *rq)
+{
+	struct bfq_group_stats *stats = &bfqq_group(bfqq)->stats;
+	u32 latency = (u32)ktime_to_us(ktime_get()) - RQ_INSERT_USEC(rq);
+
+	stats->requests++;
+	stats->latency += latency;
+	if (latency > stats->max_latency)
+		stats->max_latency = latency;
+}
+
+/*
+ * The statistics of all the groups of the cgroup, i.e., of the cgroup
+ * on all the devices, each read under the lock of its device.  The
+ * group list is walked under RCU rather than under bgrp->lock, as the
+ * queue lock nests outside bgrp->lock (see bfq_group_chain_link()).
+ * Groups are only freed by bfqio_destroy(), which cannot run while we
+ * hold the cgroup lock, or by device exit, which unlinks the root group
+ * before its grace period.
+ */
+static int bfqio_cgroup_stat_read(struct cgroup *cgroup,
+				  struct cftype *cftype,
+				  struct cgroup_map_cb *cb)
+{
+	struct bfqio_cgroup *bgrp;
+	struct bfq_group *bfqg;
+	struct bfq_data *bfqd;
+	struct hlist_node *n;
+	struct bfq_group_stats sum = { 0 };
+	unsigned long uninitialized_var(flags);
+
+	if (!cgroup_lock_live_group(cgroup))
+		return -ENODEV;
+
+	bgrp = cgroup_to_bfqio(cgroup);
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(bfqg, n, &bgrp->group_data, group_node) {
+		bfqd = bfq_get_bfqd_locked(&bfqg->bfqd, &flags);
+		if (bfqd == NULL)
+			continue;
+		sum.sectors += bfqg->stats.sectors;
+		sum.requests += bfqg->stats.requests;
+		sum.latency += bfqg->stats.latency;
+		sum.max_latency = max(sum.max_latency,
+				      bfqg->stats.max_latency);
+		bfq_put_bfqd_unlock(bfqd, &flags);
+	}
+	rcu_read_unlock();
+
+	cgroup_unlock();
+
+	cb->fill(cb, "sectors", sum.sectors);
+	cb->fill(cb, "requests", sum.requests);
+	cb->fill(cb, "avg_latency_us",
+		 sum.requests ? div64_u64(sum.latency, sum.requests) : 0);
+	cb->fill(cb, "max_latency_us", sum.max_latency);
+
+	return 0;
+}
+
 #define SHOW_FUNCTION(__VAR)						\
 static u64 bfqio_cgroup_##__VAR##_read(struct cgroup *cgroup,		\
 				       struct cftype *cftype)		\
@@ -670,6 +760,10 @@ static struct cftype bfqio_files[] = {
 		.read_u64 = bfqio_cgroup_ioprio_class_read,
 		.write_u64 = bfqio_cgroup_ioprio_class_write,
 	},
+	{
+		.name = "stat",
+		.read_map = bfqio_cgroup_stat_read,
+	},
 };
 
 static int bfqio_populate(struct cgroup_subsys *subsys, struct cgroup *cgroup)
@@ -809,6 +903,20 @@ static inline void bfq_bfqq_move(struct bfq_data *bfqd,
 {
 }
 
+static inline void bfq_group_stats_insert(struct request *rq)
+{
+}
+
+static inline void bfq_group_stats_dispatch(struct bfq_queue *bfqq,
+					    struct request *rq)
+{
+}
+
+static inline void bfq_group_stats_complete(struct bfq_queue *bfqq,
+					    struct request *rq)
+{
+}
+
 static inline void bfq_disconnect_groups(struct bfq_data *bfqd)
 {
 	bfq_put_async_queues(bfqd, bfqd->root_group);
@@ -143,6 +143,8 @@ static DEFINE_IDA(cic_index_ida);
 #define RQ_CIC(rq)		\
 	((struct cfq_io_context *) (rq)->elevator_private[0])
 #define RQ_BFQQ(rq)		((rq)->elevator_private[1])
+/* Insertion time of the request (usec), for the group statistics */
+#define RQ_INSERT_USEC(rq)	((u32)(unsigned long)(rq)->elevator_private[2])
 
 static inline void bfq_schedule_dispatch(struct bfq_data *bfqd);
 
@@ -962,6 +964,7 @@ static void bfq_dispatch_insert(struct request_queue *q, struct request *rq)
 
 	bfq_remove_request(rq);
 	bfqq->dispatched++;
+	bfq_group_stats_dispatch(bfqq, rq);
 	elv_dispatch_sort(q, rq);
 
 	if (bfq_bfqq_sync(bfqq))
@@ -1058,6 +1061,7 @@ static void __bfq_bfqq_expire(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 {
 	BUG_ON(bfqq != bfqd->active_queue);
 
+	bfq_bfqq_flush_service(bfqq);
 	__bfq_bfqd_reset_active(bfqd);
 
 	if (RB_EMPTY_ROOT(&bfqq->sort_list)) {
@@ -2215,6 +2219,7 @@ static void bfq_insert_request(struct request_queue *q, struct request *rq)
 
 	rq_set_fifo_time(rq, jiffies + bfqd->bfq_fifo_expire[rq_is_sync(rq)]);
 	list_add_tail(&rq->queuelist, &bfqq->fifo);
+	bfq_group_stats_insert(rq);
 
 	bfq_rq_enqueued(bfqd, bfqq, rq);
 }
@@ -2259,6 +2264,7 @@ static void bfq_completed_request(struct request_queue *q, struct request *rq)
 	WARN_ON(!bfqq->dispatched);
 	bfqd->rq_in_driver--;
 	bfqq->dispatched--;
+	bfq_group_stats_complete(bfqq, rq);
 
 	if (bfq_bfqq_sync(bfqq))
 		bfqd->sync_flight--;
@@ -2690,6 +2696,7 @@ static void *bfq_init_queue(struct request_queue *q)
 	bfqd->bfq_timeout[BLK_RW_SYNC] = bfq_timeout_sync;
 
 	bfqd->low_latency = true;
+	bfqd->low_overhead = false;
 
 	bfqd->bfq_raising_coeff = 20;
 	bfqd->bfq_raising_rt_max_time = msecs_to_jiffies(300);
@@ -2815,6 +2822,7 @@ SHOW_FUNCTION(bfq_max_budget_async_rq_show, bfqd->bfq_max_budget_async_rq, 0);
 SHOW_FUNCTION(bfq_timeout_sync_show, bfqd->bfq_timeout[BLK_RW_SYNC], 1);
 SHOW_FUNCTION(bfq_timeout_async_show, bfqd->bfq_timeout[BLK_RW_ASYNC], 1);
 SHOW_FUNCTION(bfq_low_latency_show, bfqd->low_latency, 0);
+SHOW_FUNCTION(bfq_low_overhead_show, bfqd->low_overhead, 0);
 SHOW_FUNCTION(bfq_raising_coeff_show, bfqd->bfq_raising_coeff, 0);
 SHOW_FUNCTION(bfq_raising_rt_max_time_show, bfqd->bfq_raising_rt_max_time, 1);
 SHOW_FUNCTION(bfq_raising_min_idle_time_show, bfqd->bfq_raising_min_idle_time,
@@ -2844,6 +2852,7 @@ __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
 	return ret;							\
 }
 STORE_FUNCTION(bfq_quantum_store, &bfqd->bfq_quantum, 1, INT_MAX, 0);
+STORE_FUNCTION(bfq_low_overhead_store, &bfqd->low_overhead, 0, 1, 0);
 STORE_FUNCTION(bfq_fifo_expire_sync_store, &bfqd->bfq_fifo_expire[1], 1,
 		INT_MAX, 1);
 STORE_FUNCTION(bfq_fifo_expire_async_store, &bfqd->bfq_fifo_expire[0], 1,
@@ -2955,6 +2964,7 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(timeout_sync),
 	BFQ_ATTR(timeout_async),
 	BFQ_ATTR(low_latency),
+	BFQ_ATTR(low_overhead),
 	BFQ_ATTR(raising_coeff),
 	BFQ_ATTR(raising_max_time),
 	BFQ_ATTR(raising_rt_max_time),
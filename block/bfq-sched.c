@@ -582,9 +582,13 @@ __bfq_entity_update_weight_prio(struct bfq_service_tree *old_st,
  *
  * NOTE: this can be optimized, as the timestamps of upper level entities
  * are synchronized every time a new bfqq is selected for service.  By now,
- * we keep it to better check consistency.
+ * we keep it to better check consistency, unless low_overhead is set: then
+ * only the service of @bfqq itself, which drives its expiration, is kept
+ * exact, and the rest is charged every BFQ_SERVICE_BATCH dispatches, and
+ * always before the queue leaves service (see bfq_bfqq_flush_service()).
  */
-static void bfq_bfqq_served(struct bfq_queue *bfqq, unsigned long served)
+static void __bfq_bfqq_served(struct bfq_queue *bfqq, unsigned long served,
+			      int leaf_charged)
 {
 	struct bfq_entity *entity = &bfqq->entity;
 	struct bfq_service_tree *st;
@@ -592,13 +596,46 @@ static void bfq_bfqq_served(struct bfq_queue *bfqq, unsigned long served)
 	for_each_entity(entity) {
 		st = bfq_entity_service_tree(entity);
 
-		entity->service += served;
+		if (!leaf_charged || entity != &bfqq->entity)
+			entity->service += served;
 		BUG_ON(entity->service > entity->budget);
 		BUG_ON(st->wsum == 0);
 
 		st->vtime += bfq_delta(served, st->wsum);
 		bfq_forget_idle(st);
 	}
+}
+
+/**
+ * bfq_bfqq_flush_service - charge the service batched for @bfqq.
+ * @bfqq: the queue.
+ *
+ * Must be called before @bfqq leaves service or changes parent.
+ */
+static void bfq_bfqq_flush_service(struct bfq_queue *bfqq)
+{
+	if (bfqq->pending_reqs == 0)
+		return;
+
+	__bfq_bfqq_served(bfqq, bfqq->pending_service, 1);
+	bfqq->pending_service = 0;
+	bfqq->pending_reqs = 0;
+}
+
+static void bfq_bfqq_served(struct bfq_queue *bfqq, unsigned long served)
+{
+	struct bfq_entity *entity = &bfqq->entity;
+
+	if (bfqq->bfqd->low_overhead) {
+		entity->service += served;
+		BUG_ON(entity->service > entity->budget);
+
+		bfqq->pending_service += served;
+		if (++bfqq->pending_reqs >= BFQ_SERVICE_BATCH)
+			bfq_bfqq_flush_service(bfqq);
+	} else
+		__bfq_bfqq_served(bfqq, served, 0);
+
 	bfq_log_bfqq(bfqq->bfqd, bfqq, "bfqq_served %lu secs", served);
 }
 
@@ -910,7 +947,9 @@ static struct bfq_entity *__bfq_lookup_next_entity(struct bfq_service_tree *st,
  * hierarchy, the complexity of the lookup can be decreased with
  * absolutely no effort just returning the cached next_active value;
  * we prefer to do full lookups to test the consistency of * the data
- * structures.
+ * structures, unless low_overhead is set.  The cache is maintained
+ * only with hierarchical scheduling, and there it saves a lookup per
+ * level.
  */
 static struct bfq_entity *bfq_lookup_next_entity(struct bfq_sched_data *sd,
 						 int extract,
@@ -931,6 +970,16 @@ static struct bfq_entity *bfq_lookup_next_entity(struct bfq_sched_data *sd,
 			sd->next_active = entity;
 		}
 	}
+#ifdef CONFIG_CGROUP_BFQIO
+	else if (extract && bfqd != NULL && bfqd->low_overhead &&
+		 sd->next_active != NULL) {
+		entity = sd->next_active;
+		bfq_active_extract(bfq_entity_service_tree(entity), entity);
+		sd->active_entity = entity;
+		sd->next_active = NULL;
+		return entity;
+	}
+#endif
 	for (; i < BFQ_IOPRIO_CLASSES; i++) {
 		entity = __bfq_lookup_next_entity(st + i, false);
 		if (entity != NULL) {
@@ -28,6 +28,9 @@
 #define BFQ_DEFAULT_GRP_IOPRIO	0
 #define BFQ_DEFAULT_GRP_CLASS	IOPRIO_CLASS_BE
 
+/* Dispatches whose service is charged at once in low_overhead mode */
+#define BFQ_SERVICE_BATCH	8
+
 struct bfq_entity;
 
 /**
@@ -188,6 +191,9 @@ struct bfq_group;
  * @pid: pid of the process owning the queue, used for logging purposes.
  * @last_rais_start_time: last (idle -> weight-raised) transition attempt
  * @raising_cur_max_time: current max raising time for this queue
+ * @pending_service: service received by the queue and not yet charged to
+ *                   its ancestors and service trees (low_overhead mode).
+ * @pending_reqs: number of dispatches @pending_service accounts for.
  *
  * A bfq_queue is a leaf request queue; it can be associated to an io_context
  * or more (if it is an async one).  @cgroup holds a reference to the
@@ -236,6 +242,9 @@ struct bfq_queue {
 	unsigned int raising_cur_max_time;
 	u64 last_rais_start_finish, soft_rt_next_start;
 	unsigned int raising_coeff;
+
+	unsigned long pending_service;
+	unsigned int pending_reqs;
 };
 
 /**
@@ -301,6 +310,10 @@ struct bfq_queue {
  *			         sectors per seconds
  * @RT_prod: cached value of the product R*T used for computing the maximum
  * 	     duration of the weight raising automatically
+ * @low_overhead: charge the service of the active queue to the upper
+ *                levels of the hierarchy every BFQ_SERVICE_BATCH
+ *                dispatches instead of on each one, and select the next
+ *                entity to serve from the cached next_active ones.
  * @oom_bfqq: fallback dummy bfqq for extreme OOM conditions
  *
  * All the fields are protected by the @queue lock.
@@ -365,6 +378,8 @@ struct bfq_data {
 	unsigned int bfq_raising_max_softrt_rate;
 	u64 RT_prod;
 
+	bool low_overhead;
+
 	struct bfq_queue oom_bfqq;
 };
 
@@ -425,6 +440,21 @@ enum bfqq_expiration {
 };
 
 #ifdef CONFIG_CGROUP_BFQIO
+/**
+ * struct bfq_group_stats - service received by a group on a device.
+ * @sectors: sectors dispatched.
+ * @requests: requests completed.
+ * @latency: sum of the latencies of the completed requests, from their
+ *           insertion into the scheduler (usec).
+ * @max_latency: longest of those latencies (usec).
+ */
+struct bfq_group_stats {
+	u64 sectors;
+	u64 requests;
+	u64 latency;
+	u32 max_latency;
+};
+
 /**
  * struct bfq_group - per (device, cgroup) data structure.
  * @entity: schedulable entity to insert into the parent group sched_data.
@@ -441,6 +471,7 @@ enum bfqq_expiration {
  * @async_idle_bfqq: async queue for the idle class (ioprio is ignored).
  * @my_entity: pointer to @entity, %NULL for the toplevel group; used
  *             to avoid too many special cases during group creation/migration.
+ * @stats: service statistics, exported through the bfqio.stat file.
  *
  * Each (device, cgroup) pair has its own bfq_group, i.e., for each cgroup
  * there is a set of bfq_groups, each one collecting the lower-level
@@ -466,6 +497,8 @@ struct bfq_group {
 	struct bfq_queue *async_idle_bfqq;
 
 	struct bfq_entity *my_entity;
+
+	struct bfq_group_stats stats;
 };
 
 /**
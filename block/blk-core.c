@@ -33,6 +33,7 @@
 #include <trace/events/block.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
@@ -55,7 +56,7 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
-static void drive_stat_acct(struct request *rq, int new_io)
+void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
 	int rw = rq_data_dir(rq);
@@ -86,6 +87,7 @@ static void drive_stat_acct(struct request *rq, int new_io)
 		part_round_stats(cpu, part);
 		part_inc_in_flight(part, rw);
 		rq->part = part;
+		blk_lat_hist_queued(rq);
 	}
 
 	part_stat_unlock();
@@ -286,6 +288,8 @@ void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
 	cancel_delayed_work_sync(&q->delay_work);
+	if (q->mq_ops)
+		blk_mq_sync_queue(q);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -362,6 +366,8 @@ void blk_cleanup_queue(struct request_queue *q)
 	 * not have processes doing IO to this device.
 	 */
 	blk_sync_queue(q);
+	if (q->mq_ops)
+		blk_mq_exit_queue(q);
 
 	del_timer_sync(&q->backing_dev_info.laptop_mode_wb_timer);
 	mutex_lock(&q->sysfs_lock);
@@ -833,6 +839,10 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 	if (unlikely(test_bit(QUEUE_FLAG_DEAD, &q->queue_flags)))
 		return NULL;
 
+	/* multi-queue requests only ever come from bios */
+	if (q->mq_ops)
+		return NULL;
+
 	BUG_ON(rw != READ && rw != WRITE);
 
 	spin_lock_irq(q->queue_lock);
@@ -1783,7 +1793,51 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
-static void blk_account_io_done(struct request *req)
+#ifdef CONFIG_BLK_IO_LAT_HIST
+static void part_lat_hist_add(int cpu, struct hd_struct *part,
+			      struct request *rq, int wait, int service)
+{
+	struct disk_lat_hist __percpu *hist = rcu_dereference(part->lat_hist);
+	const int sync = rq_is_sync(rq);
+	const int rw = rq_data_dir(rq);
+	struct disk_lat_hist *h;
+
+	if (!hist)
+		return;
+
+	h = per_cpu_ptr(hist, cpu);
+	h->buckets[DISK_LAT_WAIT][sync][rw][wait]++;
+	h->buckets[DISK_LAT_SERVICE][sync][rw][service]++;
+}
+
+static inline int lat_hist_bucket(u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	return min_t(int, fls(min_t(u64, us, UINT_MAX)), DISK_LAT_BUCKETS - 1);
+}
+
+/* Called under part_stat_lock(), which keeps the histograms around */
+void blk_lat_hist_done(int cpu, struct request *rq)
+{
+	struct hd_struct *part = rq->part;
+	int wait, service;
+
+	if (!rq->lat_hist_start_ns || !rq->lat_hist_io_start_ns)
+		return;
+
+	wait = lat_hist_bucket(rq->lat_hist_io_start_ns -
+			       rq->lat_hist_start_ns);
+	service = lat_hist_bucket(ktime_to_ns(ktime_get()) -
+				  rq->lat_hist_io_start_ns);
+
+	part_lat_hist_add(cpu, part, rq, wait, service);
+	if (part->partno)
+		part_lat_hist_add(cpu, &rq->rq_disk->part0, rq, wait, service);
+}
+#endif
+
+void blk_account_io_done(struct request *req)
 {
 	/*
 	 * Account IO completion.  flush_rq isn't accounted as a
@@ -1803,6 +1857,7 @@ static void blk_account_io_done(struct request *req)
 		part_stat_add(cpu, part, ticks[rw], duration);
 		part_round_stats(cpu, part);
 		part_dec_in_flight(part, rw);
+		blk_lat_hist_done(cpu, req);
 
 		hd_struct_put(part);
 		part_stat_unlock();
@@ -1926,6 +1981,7 @@ void blk_dequeue_request(struct request *rq)
 	if (blk_account_rq(rq)) {
 		q->in_flight[rq_is_sync(rq)]++;
 		set_io_start_time_ns(rq);
+		blk_lat_hist_started(rq);
 	}
 }
 
@@ -0,0 +1,546 @@
+/*
+ * Multi-queue request submission, see include/linux/blk-mq.h
+ *
+ * Requests never go near q->queue_lock: a bio becomes a request on the
+ * submitting cpu, is staged on that cpu's software queue under its own
+ * lock and is handed to the driver when the hardware context that queue
+ * maps to runs. Tags and the requests behind them are per hardware
+ * context, and completions are bounced back to the submitting cpu.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/ioprio.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/cache.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * Default mapping of software queues to hardware contexts, for drivers to
+ * use as their ->map_queue: cpus are spread evenly over the contexts.
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[cpu % q->nr_hw_queues];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static unsigned int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(hctx->tag_map, hctx->queue_depth);
+		if (tag >= hctx->queue_depth)
+			return -1U;
+	} while (test_and_set_bit_lock(tag, hctx->tag_map));
+
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	clear_bit_unlock(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+
+	if (waitqueue_active(&hctx->tag_wait))
+		wake_up(&hctx->tag_wait);
+}
+
+/*
+ * Returns a request for a bio submitted on the cpu of 'ctx', waiting for a
+ * tag to free up if they are all in use. Can not fail.
+ */
+static struct request *blk_mq_alloc_request(struct request_queue *q,
+					    struct blk_mq_hw_ctx *hctx,
+					    struct blk_mq_ctx *ctx)
+{
+	struct request *rq;
+	unsigned int tag;
+
+	wait_event(hctx->tag_wait, (tag = blk_mq_get_tag(hctx)) != -1U);
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->mq_ctx = ctx;
+	rq->tag = tag;
+	rq->cpu = ctx->cpu;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+static void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+
+	blk_mq_put_tag(hctx, rq->tag);
+}
+
+/**
+ * blk_mq_end_io - end a multi-queue request
+ * @rq:		the request, as handed to ->queue_rq
+ * @error:	0 for success, < 0 for error
+ *
+ * Description:
+ *     Ends all of the request's bios and gives its tag back.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+	blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void __blk_mq_complete_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (q->mq_ops->complete)
+		q->mq_ops->complete(rq);
+	else
+		blk_mq_end_io(rq, rq->errors);
+}
+
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+static void blk_mq_complete_remote(void *data)
+{
+	__blk_mq_complete_request(data);
+}
+
+static bool blk_mq_complete_on(struct request *rq, int cpu)
+{
+	struct call_single_data *data = &rq->csd;
+
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags) ||
+	    rq->cpu == cpu || !cpu_online(rq->cpu))
+		return false;
+
+	data->func = blk_mq_complete_remote;
+	data->info = rq;
+	data->flags = 0;
+	__smp_call_function_single(rq->cpu, data, 0);
+	return true;
+}
+#else
+static bool blk_mq_complete_on(struct request *rq, int cpu)
+{
+	return false;
+}
+#endif
+
+/**
+ * blk_mq_complete_request - end a multi-queue request from any context
+ * @rq:		the request, with rq->errors set
+ *
+ * Description:
+ *     Runs the driver's ->complete, or blk_mq_end_io() without one, on the
+ *     cpu the request was submitted from, unless rq_affinity is off for
+ *     the queue, in which case it runs right here.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	int cpu = get_cpu();
+
+	if (!blk_mq_complete_on(rq, cpu))
+		__blk_mq_complete_request(rq);
+	put_cpu();
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+/* Moves the requests of every software queue with work to 'list' */
+static void blk_mq_flush_ctxs(struct blk_mq_hw_ctx *hctx,
+			      struct list_head *list)
+{
+	int bit;
+
+	for (bit = find_first_bit(hctx->ctx_map, hctx->nr_ctx);
+	     bit < hctx->nr_ctx;
+	     bit = find_next_bit(hctx->ctx_map, hctx->nr_ctx, bit + 1)) {
+		struct blk_mq_ctx *ctx = hctx->ctxs[bit];
+
+		if (!test_and_clear_bit(bit, hctx->ctx_map))
+			continue;
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, list);
+		spin_unlock(&ctx->lock);
+	}
+}
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/* what the driver bounced last time goes first */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+	blk_mq_flush_ctxs(hctx, &rq_list);
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		blk_lat_hist_started(rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		if (ret != BLK_MQ_RQ_QUEUE_ERROR)
+			pr_err("blk-mq: bad return on queue: %d\n", ret);
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	if (list_empty(&rq_list))
+		return;
+
+	spin_lock(&hctx->lock);
+	list_splice(&rq_list, &hctx->dispatch);
+	spin_unlock(&hctx->lock);
+
+	/*
+	 * The driver stopped the context before saying it was busy. If it
+	 * has already been restarted, that run may have missed what we just
+	 * put back, so go again.
+	 */
+	if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		blk_mq_run_hw_queue(hctx, true);
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the pending requests of a hardware context
+ * @hctx:	the hardware context
+ * @async:	leave it to kblockd rather than dispatching from here
+ *
+ * Description:
+ *     Must be called with @async set from atomic context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_run_hw_queue(q->queue_hw_ctx[i], async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/*
+ * Restarts the stopped hardware contexts of a queue. Their requests are
+ * dispatched from kblockd, so this may be called from any context.
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+/*
+ * Only the last request staged on this cpu is looked at: it is the one a
+ * sequential stream from this cpu would extend.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	const int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	struct request *rq;
+	bool merged = false;
+
+	if (bio->bi_rw & RQ_NOMERGE_FLAGS || blk_queue_nomerges(q))
+		return false;
+
+	spin_lock(&ctx->lock);
+	if (list_empty(&ctx->rq_list))
+		goto out;
+
+	rq = list_entry_rq(ctx->rq_list.prev);
+	if (!elv_rq_merge_ok(rq, bio) ||
+	    blk_rq_pos(rq) + blk_rq_sectors(rq) != bio->bi_sector ||
+	    !ll_back_merge_fn(q, rq, bio))
+		goto out;
+
+	trace_block_bio_backmerge(q, bio);
+
+	if ((rq->cmd_flags & REQ_FAILFAST_MASK) != ff)
+		blk_rq_set_mixed_merge(rq);
+
+	rq->biotail->bi_next = bio;
+	rq->biotail = bio;
+	rq->__data_len += bio->bi_size;
+	rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+
+	drive_stat_acct(rq, 0);
+	merged = true;
+out:
+	spin_unlock(&ctx->lock);
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool sync = rw_is_sync(bio->bi_rw);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	/*
+	 * Being moved to another cpu from here on is harmless: the software
+	 * queue is locked, and only decides where the request completes.
+	 */
+	ctx = __blk_mq_get_ctx(q, raw_smp_processor_id());
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    blk_mq_attempt_merge(q, ctx, bio))
+		return 0;
+
+	rq = blk_mq_alloc_request(q, hctx, ctx);
+	trace_block_getrq(q, bio, bio_data_dir(bio));
+	init_request_from_bio(rq, bio);
+	rq->cpu = ctx->cpu;
+	drive_stat_acct(rq, 1);
+
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	set_bit(ctx->index_hw, hctx->ctx_map);
+	spin_unlock(&ctx->lock);
+	trace_block_rq_insert(q, rq);
+
+	/* let async writeback build up and go out from kblockd in batches */
+	blk_mq_run_hw_queue(hctx, !sync);
+	return 0;
+}
+
+static void blk_mq_free_hctx(struct blk_mq_hw_ctx *hctx)
+{
+	kfree(hctx->rq_mem);
+	kfree(hctx->rqs);
+	kfree(hctx->tag_map);
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+	free_cpumask_var(hctx->cpumask);
+	kfree(hctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       void *driver_data,
+					       unsigned int index)
+{
+	size_t rq_size = ALIGN(sizeof(struct request) + reg->cmd_size,
+			       cache_line_size());
+	unsigned int depth = reg->queue_depth;
+	int node = reg->numa_node;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+	if (!zalloc_cpumask_var_node(&hctx->cpumask, GFP_KERNEL, node)) {
+		kfree(hctx);
+		return NULL;
+	}
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  node);
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+				     sizeof(unsigned long), GFP_KERNEL, node);
+	hctx->tag_map = kzalloc_node(BITS_TO_LONGS(depth) *
+				     sizeof(unsigned long), GFP_KERNEL, node);
+	hctx->rqs = kzalloc_node(depth * sizeof(struct request *), GFP_KERNEL,
+				 node);
+	hctx->rq_mem = kzalloc_node(depth * rq_size, GFP_KERNEL, node);
+	if (!hctx->ctxs || !hctx->ctx_map || !hctx->tag_map || !hctx->rqs ||
+	    !hctx->rq_mem)
+		goto err;
+
+	for (i = 0; i < depth; i++)
+		hctx->rqs[i] = hctx->rq_mem + i * rq_size;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->tag_wait);
+	hctx->queue = q;
+	hctx->queue_num = index;
+	hctx->queue_depth = depth;
+	hctx->flags = reg->flags;
+	hctx->driver_data = driver_data;
+
+	if (reg->ops->init_hctx && reg->ops->init_hctx(hctx, driver_data, index))
+		goto err;
+
+	return hctx;
+
+err:
+	blk_mq_free_hctx(hctx);
+	return NULL;
+}
+
+/**
+ * blk_mq_init_queue - prepare a multi-queue request queue for a device
+ * @reg:		the driver's operations and queue geometry
+ * @driver_data:	passed to ->init_hctx, and the default driver_data
+ *			of each hardware context
+ *
+ * Description:
+ *     Returns the queue, or %NULL if @reg is invalid or on allocation
+ *     failure. It is torn down with blk_cleanup_queue() like any other.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct request_queue *q;
+	unsigned int i;
+	int cpu;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->mq_ops = reg->ops;
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(hctx),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto err;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = blk_mq_alloc_hctx(q, reg, driver_data, i);
+		if (!hctx)
+			goto err;
+		q->queue_hw_ctx[i] = hctx;
+		q->nr_hw_queues++;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = __blk_mq_get_ctx(q, cpu);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, cpu);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+		cpumask_set_cpu(cpu, hctx->cpumask);
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->nr_requests = reg->queue_depth * reg->nr_hw_queues;
+	q->queue_flags |= QUEUE_FLAG_DEFAULT;
+
+	return q;
+
+err:
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/* From blk_sync_queue(): no context may be left running */
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		cancel_work_sync(&q->queue_hw_ctx[i]->run_work);
+}
+
+/* From blk_cleanup_queue(), while the driver is still around */
+void blk_mq_exit_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	if (!q->mq_ops->exit_hctx)
+		return;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		q->mq_ops->exit_hctx(q->queue_hw_ctx[i], i);
+}
+
+/* From the release of the queue's last reference */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_free_hctx(q->queue_hw_ctx[i]);
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+}
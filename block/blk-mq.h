@@ -0,0 +1,23 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software queue. Requests are staged here by the cpu that
+ * submitted them until the hardware context it maps to runs.
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in the hctx's ctx_map */
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+void blk_mq_sync_queue(struct request_queue *q);
+void blk_mq_exit_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+
+#endif
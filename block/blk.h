@@ -20,6 +20,9 @@ void __blk_queue_free_tags(struct request_queue *q);
 bool __blk_end_bidi_request(struct request *rq, int error,
 			    unsigned int nr_bytes, unsigned int bidi_bytes);
 
+void drive_stat_acct(struct request *rq, int new_io);
+void blk_account_io_done(struct request *req);
+
 void blk_rq_timed_out_timer(unsigned long data);
 void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
@@ -117,6 +120,34 @@ static inline void elv_deactivate_rq(struct request_queue *q, struct request *rq
 		e->ops->elevator_deactivate_req_fn(q, rq);
 }
 
+#ifdef CONFIG_BLK_IO_LAT_HIST
+void blk_lat_hist_done(int cpu, struct request *rq);
+
+/* Called under part_stat_lock(), once rq->part is known */
+static inline void blk_lat_hist_queued(struct request *rq)
+{
+	if (rcu_access_pointer(rq->part->lat_hist) ||
+	    rcu_access_pointer(rq->rq_disk->part0.lat_hist))
+		rq->lat_hist_start_ns = ktime_to_ns(ktime_get());
+}
+
+static inline void blk_lat_hist_started(struct request *rq)
+{
+	if (rq->lat_hist_start_ns)
+		rq->lat_hist_io_start_ns = ktime_to_ns(ktime_get());
+}
+#else
+static inline void blk_lat_hist_done(int cpu, struct request *rq)
+{
+}
+static inline void blk_lat_hist_queued(struct request *rq)
+{
+}
+static inline void blk_lat_hist_started(struct request *rq)
+{
+}
+#endif
+
 #ifdef CONFIG_FAIL_IO_TIMEOUT
 int blk_should_fake_timeout(struct request_queue *);
 ssize_t part_timeout_show(struct device *, struct device_attribute *, char *);
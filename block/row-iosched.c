@@ -26,6 +26,8 @@
 #include <linux/compiler.h>
 #include <linux/blktrace_api.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 
 /*
  * enum row_queue_prio - Priorities of the ROW queues
@@ -69,6 +71,28 @@ static const bool urgent_queues[] = {
 	false,	/* ROWQ_PRIO_LOW_SWRITE */
 };
 
+/* Flags indicating whether the queue quantum is scaled in adaptive mode */
+static const bool queue_quantum_scaled[] = {
+	false,	/* ROWQ_PRIO_HIGH_READ */
+	false,	/* ROWQ_PRIO_REG_READ */
+	true,	/* ROWQ_PRIO_HIGH_SWRITE */
+	true,	/* ROWQ_PRIO_REG_SWRITE */
+	true,	/* ROWQ_PRIO_REG_WRITE */
+	false,	/* ROWQ_PRIO_LOW_READ */
+	true,	/* ROWQ_PRIO_LOW_SWRITE */
+};
+
+/* Queue names, as used by the sysfs quantum attributes */
+static const char * const queue_names[] = {
+	"hp_read",	/* ROWQ_PRIO_HIGH_READ */
+	"rp_read",	/* ROWQ_PRIO_REG_READ */
+	"hp_swrite",	/* ROWQ_PRIO_HIGH_SWRITE */
+	"rp_swrite",	/* ROWQ_PRIO_REG_SWRITE */
+	"rp_write",	/* ROWQ_PRIO_REG_WRITE */
+	"lp_read",	/* ROWQ_PRIO_LOW_READ */
+	"lp_swrite",	/* ROWQ_PRIO_LOW_SWRITE */
+};
+
 /* Default values for row queues quantums in each dispatch cycle */
 static const int queue_quantum[] = {
 	100,	/* ROWQ_PRIO_HIGH_READ */
@@ -83,19 +107,58 @@ static const int queue_quantum[] = {
 /* Default values for idling on read queues (in msec) */
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 20
+/* Upper bound for both, so that they still fit in a u32 in usec */
+#define ROW_IDLE_MAX_MSEC ((int)(UINT_MAX / USEC_PER_MSEC))
+
+/*
+ * Adaptive mode. Every ROW_ADAPT_SAMPLES completions from the read queues
+ * the average read latency, from insertion to completion, is compared to
+ * read_lat_target. While reads take less than half the target, the quanta
+ * of the write queues are grown by ROW_WSCALE_STEP percent, up to
+ * ROW_WSCALE_MAX percent of their configured values; as soon as reads miss
+ * the target the scale is halved, down to the configured values. The idle
+ * window on a read queue follows twice its think time, bounded below by
+ * ROW_MIN_IDLE_USEC and above by read_idle, and is read_idle whenever the
+ * queue misses the target.
+ */
+#define ROW_READ_LAT_TARGET_USEC	10000
+#define ROW_ADAPT_SAMPLES		16
+#define ROW_WSCALE_MIN			100
+#define ROW_WSCALE_STEP			50
+#define ROW_WSCALE_MAX			800
+#define ROW_MIN_IDLE_USEC		250
+
+/* Completion latency histogram: bucket i counts latencies below 2^i usec */
+#define ROW_LAT_BUCKETS			20
 
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
  *			to the queue
+ * @think_time:		average time between two inserts (usec),
+ *			capped at the idling frequency
  * @begin_idling:	flag indicating wether we should idle
  *
  */
 struct rowq_idling_data {
 	ktime_t			last_insert_time;
+	u32			think_time;
 	bool			begin_idling;
 };
 
+/**
+ * struct rowq_lat_stats - completion latency of the queue requests
+ * @avg:		moving average of the latency (usec)
+ * @nr:			number of completed requests
+ * @hist:		log2 histogram of the latency
+ *
+ */
+struct rowq_lat_stats {
+	u32			avg;
+	unsigned long		nr;
+	unsigned long		hist[ROW_LAT_BUCKETS];
+};
+
 /**
  * struct row_queue - requests grouping structure
  * @rdata:		parent row_data structure
@@ -105,6 +168,7 @@ struct rowq_idling_data {
  *			the current dispatch cycle
  * @slice:		number of requests to dispatch in a cycle
  * @idle_data:		data for idling on queues
+ * @lat:		completion latency statistics
  *
  */
 struct row_queue {
@@ -117,22 +181,43 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	struct rowq_lat_stats	lat;
 };
 
 /**
  * struct idling_data - data for idling on empty rqueue
- * @idle_time:		idling duration (jiffies)
+ * @idle_time:		idling duration, the longest one in
+ *			adaptive mode (msec)
  * @freq:		min time between two requests that
  *			triger idling (msec)
- * @idle_work:		pointer to struct delayed_work
+ * @hr_timer:		idling timer
+ * @idle_work:		work kicking the queue once idling is over
  *
  */
 struct idling_data {
-	unsigned long			idle_time;
+	u32				idle_time;
 	u32				freq;
 
+	struct hrtimer			hr_timer;
 	struct workqueue_struct	*idle_workqueue;
-	struct delayed_work		idle_work;
+	struct work_struct		idle_work;
+};
+
+/**
+ * struct row_adapt_data - state of the adaptive mode
+ * @enabled:		adapt quanta and idling to the read latency
+ * @read_lat_target:	target read latency (usec)
+ * @write_scale:	write queue quanta, in percent of their
+ *			configured values
+ * @nr_samples:		read completions since the last adaptation
+ *
+ */
+struct row_adapt_data {
+	int				enabled;
+	int				read_lat_target;
+	int				write_scale;
+	unsigned int			nr_samples;
 };
 
 /**
@@ -147,6 +232,7 @@ struct idling_data {
  *			scheduler, nr_reqs[1] holds the number of all WRITE
  *			requests in scheduler
  * @cycle_flags:	used for marking unserved queueus
+ * @adapt:		adaptive mode state
  *
  */
 struct row_data {
@@ -163,9 +249,15 @@ struct row_data {
 	unsigned int			nr_reqs[2];
 
 	unsigned int			cycle_flags;
+
+	struct row_adapt_data		adapt;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elevator_private[0]))
+/* Insertion time of the request (usec), wraps every ~71 minutes */
+#define RQ_INSERT_USEC(rq) ((u32)(unsigned long)((rq)->elevator_private[1]))
+#define RQ_SET_INSERT_USEC(rq, t) \
+	((rq)->elevator_private[1] = (void *)(unsigned long)(t))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -191,20 +283,25 @@ static inline int row_rowq_unserved(struct row_data *rd,
 	return rd->cycle_flags & (1 << qnum);
 }
 
+static inline u32 row_ktime_to_usec(ktime_t kt)
+{
+	return (u32)ktime_to_us(kt);
+}
+
 /******************** Static helper functions ***********************/
 /*
  * kick_queue() - Wake up device driver queue thread
  * @work:	pointer to struct work_struct
  *
- * This is a idling delayed work function. It's purpose is to wake up the
- * device driver in order for it to start fetching requests.
+ * This is the idling work function, queued when the idling timer expires.
+ * It's purpose is to wake up the device driver in order for it to start
+ * fetching requests.
  *
  */
 static void kick_queue(struct work_struct *work)
 {
-	struct delayed_work *idle_work = to_delayed_work(work);
 	struct idling_data *read_data =
-		container_of(idle_work, struct idling_data, idle_work);
+		container_of(work, struct idling_data, idle_work);
 	struct row_data *rd =
 		container_of(read_data, struct row_data, read_idle);
 
@@ -248,6 +345,83 @@ static inline void row_get_next_queue(struct row_data *rd)
 		row_restart_disp_cycle(rd);
 }
 
+/*
+ * row_idle_timer_fn() - Idling timer callback
+ * @hr_timer:	pointer to the idling struct hrtimer
+ *
+ * The queue can't be run from hard irq context, so hand over to
+ * kick_queue().
+ */
+static enum hrtimer_restart row_idle_timer_fn(struct hrtimer *hr_timer)
+{
+	struct idling_data *read_data =
+		container_of(hr_timer, struct idling_data, hr_timer);
+
+	queue_work(read_data->idle_workqueue, &read_data->idle_work);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * row_quantum() - Dispatch quantum of a queue
+ * @rd:		pointer to struct row_data
+ * @qnum:	queue index
+ *
+ * Returns the configured quantum, scaled by the adaptive mode for the
+ * write queues.
+ */
+static unsigned int row_quantum(struct row_data *rd, enum row_queue_prio qnum)
+{
+	u64 quantum = rd->row_queues[qnum].disp_quantum;
+
+	if (rd->adapt.enabled && queue_quantum_scaled[qnum])
+		quantum = div_u64(quantum * rd->adapt.write_scale, 100);
+
+	return min_t(u64, quantum, INT_MAX);
+}
+
+/*
+ * row_idle_window() - How long to idle on an empty read queue
+ * @rd:		pointer to struct row_data
+ * @rqueue:	the queue to idle on
+ *
+ */
+static ktime_t row_idle_window(struct row_data *rd, struct row_queue *rqueue)
+{
+	u32 max_usec = rd->read_idle.idle_time * USEC_PER_MSEC;
+	u32 usec = max_usec;
+
+	if (rd->adapt.enabled && rqueue->lat.avg <= rd->adapt.read_lat_target)
+		usec = clamp_t(u32, 2 * rqueue->idle_data.think_time,
+			       ROW_MIN_IDLE_USEC, max_usec);
+
+	return ns_to_ktime((u64)usec * NSEC_PER_USEC);
+}
+
+/*
+ * row_adapt() - Move the write queue quanta towards the read latency target
+ * @rd:	pointer to struct row_data
+ *
+ */
+static void row_adapt(struct row_data *rd)
+{
+	u32 lat = 0;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		if (queue_idling_enabled[i])
+			lat = max(lat, rd->row_queues[i].rqueue.lat.avg);
+
+	if (lat > rd->adapt.read_lat_target)
+		rd->adapt.write_scale = max(rd->adapt.write_scale / 2,
+					    ROW_WSCALE_MIN);
+	else if (lat < rd->adapt.read_lat_target / 2)
+		rd->adapt.write_scale = min(rd->adapt.write_scale +
+					    ROW_WSCALE_STEP, ROW_WSCALE_MAX);
+
+	row_log(rd->dispatch_queue, "read latency %uus, write scale %d%%",
+		lat, rd->adapt.write_scale);
+}
+
 /******************* Elevator callback functions *********************/
 
 /*
@@ -261,18 +435,30 @@ static void row_add_request(struct request_queue *q,
 {
 	struct row_data *rd = (struct row_data *)q->elevator->elevator_data;
 	struct row_queue *rqueue = RQ_ROWQ(rq);
+	ktime_t now = ktime_get();
 
 	list_add_tail(&rq->queuelist, &rqueue->fifo);
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	RQ_SET_INSERT_USEC(rq, row_ktime_to_usec(now));
 
 	if (queue_idling_enabled[rqueue->prio]) {
-		if (delayed_work_pending(&rd->read_idle.idle_work))
-			(void)cancel_delayed_work(
-				&rd->read_idle.idle_work);
-		if (ktime_to_ms(ktime_sub(ktime_get(),
-				rqueue->idle_data.last_insert_time)) <
-				rd->read_idle.freq) {
+		u32 freq_usec = rd->read_idle.freq * USEC_PER_MSEC;
+		u32 gap = min_t(s64, ktime_us_delta(now,
+				rqueue->idle_data.last_insert_time), freq_usec);
+		bool idle;
+
+		if (hrtimer_active(&rd->read_idle.hr_timer))
+			(void)hrtimer_try_to_cancel(&rd->read_idle.hr_timer);
+
+		rqueue->idle_data.think_time =
+			(rqueue->idle_data.think_time * 3 + gap) / 4;
+		if (rd->adapt.enabled)
+			idle = rqueue->idle_data.think_time < freq_usec;
+		else
+			idle = gap < freq_usec;
+
+		if (idle) {
 			rqueue->idle_data.begin_idling = true;
 			row_log_rowq(rd, rqueue->prio, "Enable idling");
 		} else {
@@ -280,7 +466,7 @@ static void row_add_request(struct request_queue *q,
 			row_log_rowq(rd, rqueue->prio, "Disable idling");
 		}
 
-		rqueue->idle_data.last_insert_time = ktime_get();
+		rqueue->idle_data.last_insert_time = now;
 	}
 	if (urgent_queues[rqueue->prio] &&
 	    row_rowq_unserved(rd, rqueue->prio)) {
@@ -323,6 +509,29 @@ static int row_reinsert_req(struct request_queue *q,
 	return 0;
 }
 
+/*
+ * row_completed_req() - Account the completion latency of a request
+ * @q:	requests queue
+ * @rq:	request that completed
+ *
+ */
+static void row_completed_req(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	struct rowq_lat_stats *lat = &rqueue->lat;
+	u32 usec = row_ktime_to_usec(ktime_get()) - RQ_INSERT_USEC(rq);
+
+	lat->hist[min_t(int, fls(usec), ROW_LAT_BUCKETS - 1)]++;
+	lat->avg = lat->nr++ ? (u32)(((u64)lat->avg * 7 + usec) >> 3) : usec;
+
+	if (rd->adapt.enabled && queue_idling_enabled[rqueue->prio] &&
+	    ++rd->adapt.nr_samples >= ROW_ADAPT_SAMPLES) {
+		rd->adapt.nr_samples = 0;
+		row_adapt(rd);
+	}
+}
+
 /*
  * row_urgent_pending() - Return TRUE if there is an urgent
  *			  request on scheduler
@@ -448,7 +657,7 @@ static int row_dispatch_requests(struct request_queue *q, int force)
 	}
 
 	if (rd->row_queues[currq].rqueue.nr_dispatched >=
-	    rd->row_queues[currq].disp_quantum) {
+	    row_quantum(rd, currq)) {
 		rd->row_queues[currq].rqueue.nr_dispatched = 0;
 		row_log_rowq(rd, currq, "Expiring rqueue");
 		ret = row_choose_queue(rd);
@@ -460,30 +669,30 @@ static int row_dispatch_requests(struct request_queue *q, int force)
 	/* Dispatch from curr_queue */
 	if (list_empty(&rd->row_queues[currq].rqueue.fifo)) {
 		/* check idling */
-		if (delayed_work_pending(&rd->read_idle.idle_work)) {
+		if (hrtimer_active(&rd->read_idle.hr_timer)) {
 			if (force) {
-				(void)cancel_delayed_work(
-				&rd->read_idle.idle_work);
+				(void)hrtimer_cancel(&rd->read_idle.hr_timer);
 				row_log_rowq(rd, currq,
-					"Canceled delayed work - forced dispatch");
+					"Canceled idling - forced dispatch");
 			} else {
 				row_log_rowq(rd, currq,
-						 "Delayed work pending. Exiting");
+						 "Idling in progress. Exiting");
 				goto done;
 			}
 		}
 
 		if (!force && queue_idling_enabled[currq] &&
 		    rd->row_queues[currq].rqueue.idle_data.begin_idling) {
-			if (!queue_delayed_work(rd->read_idle.idle_workqueue,
-						&rd->read_idle.idle_work,
-						rd->read_idle.idle_time)) {
+			if (hrtimer_start(&rd->read_idle.hr_timer,
+				row_idle_window(rd,
+					&rd->row_queues[currq].rqueue),
+				HRTIMER_MODE_REL)) {
 				row_log_rowq(rd, currq,
-					     "Work already on queue!");
-				pr_err("ROW_BUG: Work already on queue!");
+					     "Idle timer already active!");
+				pr_err("ROW_BUG: Idle timer already active!");
 			} else
 				row_log_rowq(rd, currq,
-				     "Scheduled delayed work. exiting");
+				     "Started idling. exiting");
 			goto done;
 		} else {
 			row_log_rowq(rd, currq,
@@ -528,6 +737,8 @@ static void *row_init_queue(struct request_queue *q)
 		rdata->row_queues[i].rqueue.idle_data.begin_idling = false;
 		rdata->row_queues[i].rqueue.idle_data.last_insert_time =
 			ktime_set(0, 0);
+		rdata->row_queues[i].rqueue.idle_data.think_time =
+			ROW_READ_FREQ_MSEC * USEC_PER_MSEC;
 	}
 
 	/*
@@ -535,16 +746,20 @@ static void *row_init_queue(struct request_queue *q)
 	 * enable it for write queues also, note that idling frequency will
 	 * be the same in both cases
 	 */
-	rdata->read_idle.idle_time = msecs_to_jiffies(ROW_IDLE_TIME_MSEC);
-	/* Maybe 0 on some platforms */
-	if (!rdata->read_idle.idle_time)
-		rdata->read_idle.idle_time = 1;
+	rdata->read_idle.idle_time = ROW_IDLE_TIME_MSEC;
 	rdata->read_idle.freq = ROW_READ_FREQ_MSEC;
+	hrtimer_init(&rdata->read_idle.hr_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	rdata->read_idle.hr_timer.function = row_idle_timer_fn;
 	rdata->read_idle.idle_workqueue = alloc_workqueue("row_idle_work",
 					    WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
 	if (!rdata->read_idle.idle_workqueue)
 		panic("Failed to create idle workqueue\n");
-	INIT_DELAYED_WORK(&rdata->read_idle.idle_work, kick_queue);
+	INIT_WORK(&rdata->read_idle.idle_work, kick_queue);
+
+	rdata->adapt.enabled = 1;
+	rdata->adapt.read_lat_target = ROW_READ_LAT_TARGET_USEC;
+	rdata->adapt.write_scale = ROW_WSCALE_MIN;
 
 	rdata->curr_queue = ROWQ_PRIO_HIGH_READ;
 	rdata->dispatch_queue = q;
@@ -566,8 +781,9 @@ static void row_exit_queue(struct elevator_queue *e)
 
 	for (i = 0; i < ROWQ_MAX_PRIO; i++)
 		BUG_ON(!list_empty(&rd->row_queues[i].rqueue.fifo));
-	(void)cancel_delayed_work_sync(&rd->read_idle.idle_work);
-	BUG_ON(delayed_work_pending(&rd->read_idle.idle_work));
+	(void)hrtimer_cancel(&rd->read_idle.hr_timer);
+	(void)cancel_work_sync(&rd->read_idle.idle_work);
+	BUG_ON(work_pending(&rd->read_idle.idle_work));
 	destroy_workqueue(rd->read_idle.idle_workqueue);
 	kfree(rd);
 }
@@ -669,8 +885,10 @@ SHOW_FUNCTION(row_lp_read_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_READ].disp_quantum, 0);
 SHOW_FUNCTION(row_lp_swrite_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum, 0);
-SHOW_FUNCTION(row_read_idle_show, rowd->read_idle.idle_time, 1);
+SHOW_FUNCTION(row_read_idle_show, rowd->read_idle.idle_time, 0);
 SHOW_FUNCTION(row_read_idle_freq_show, rowd->read_idle.freq, 0);
+SHOW_FUNCTION(row_adaptive_show, rowd->adapt.enabled, 0);
+SHOW_FUNCTION(row_read_lat_target_show, rowd->adapt.read_lat_target, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -708,12 +926,60 @@ STORE_FUNCTION(row_lp_read_quantum_store,
 			1, INT_MAX, 0);
 STORE_FUNCTION(row_lp_swrite_quantum_store,
 			&rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum,
-			1, INT_MAX, 1);
-STORE_FUNCTION(row_read_idle_store, &rowd->read_idle.idle_time, 1, INT_MAX, 1);
-STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq, 1, INT_MAX, 0);
+			1, INT_MAX, 0);
+STORE_FUNCTION(row_read_idle_store, &rowd->read_idle.idle_time,
+			1, ROW_IDLE_MAX_MSEC, 0);
+STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq,
+			1, ROW_IDLE_MAX_MSEC, 0);
+STORE_FUNCTION(row_adaptive_store, &rowd->adapt.enabled, 0, 1, 0);
+STORE_FUNCTION(row_read_lat_target_store, &rowd->adapt.read_lat_target,
+			1, INT_MAX, 0);
 
 #undef STORE_FUNCTION
 
+/*
+ * One line per queue: its name, the quantum currently in use, the average
+ * completion latency (usec), the number of completed requests and the
+ * latency histogram, bucket i counting the latencies below 2^i usec and
+ * the last one all the longer ones. Writing anything clears the statistics.
+ */
+static ssize_t row_latency_hist_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	ssize_t len = 0;
+	int i, b;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		struct rowq_lat_stats *lat = &rowd->row_queues[i].rqueue.lat;
+
+		len += snprintf(page + len, PAGE_SIZE - len, "%s %u %u %lu",
+				queue_names[i], row_quantum(rowd, i),
+				lat->avg, lat->nr);
+		for (b = 0; b < ROW_LAT_BUCKETS; b++)
+			len += snprintf(page + len, PAGE_SIZE - len, " %lu",
+					lat->hist[b]);
+		len += snprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
+static ssize_t row_latency_hist_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	int i;
+
+	spin_lock_irq(rowd->dispatch_queue->queue_lock);
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		memset(&rowd->row_queues[i].rqueue.lat, 0,
+		       sizeof(struct rowq_lat_stats));
+	rowd->adapt.nr_samples = 0;
+	spin_unlock_irq(rowd->dispatch_queue->queue_lock);
+
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -728,6 +994,9 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(read_idle),
 	ROW_ATTR(read_idle_freq),
+	ROW_ATTR(adaptive),
+	ROW_ATTR(read_lat_target),
+	ROW_ATTR(latency_hist),
 	__ATTR_NULL
 };
 
@@ -738,6 +1007,7 @@ static struct elevator_type iosched_row = {
 		.elevator_add_req_fn		= row_add_request,
 		.elevator_reinsert_req_fn	= row_reinsert_req,
 		.elevator_is_urgent_fn		= row_urgent_pending,
+		.elevator_completed_req_fn	= row_completed_req,
 		.elevator_former_req_fn		= elv_rb_former_request,
 		.elevator_latter_req_fn		= elv_rb_latter_request,
 		.elevator_set_req_fn		= row_set_request,
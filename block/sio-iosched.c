@@ -5,9 +5,16 @@
  * Copyright (C) 2012 Miguel Boton <mboton@gmail.com>
  *
  *
- * This algorithm does not do any kind of sorting, as it is aimed for
- * aleatory access devices, but it does some basic merging. We try to
- * keep minimum overhead to achieve low latency.
+ * This algorithm is aimed for aleatory access devices, so requests are
+ * served in fifo order and it does some basic merging. We try to keep
+ * minimum overhead to achieve low latency.
+ *
+ * Optionally ("sort_requests"), requests are also kept in a sector sorted
+ * tree per data direction, which is used for front merges and to dispatch,
+ * right after a request, those that are contiguous to it, up to fifo_batch
+ * of them. This keeps the streams of several writers from being interleaved,
+ * which defeats the write combining of SD cards and costs seeks on
+ * rotational disks.
  *
  * Asynchronous and synchronous requests are not treated separately, but
  * we relay on deadlines to ensure fairness.
@@ -18,6 +25,7 @@
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/rbtree.h>
 #include <linux/version.h>
 
 enum { ASYNC, SYNC };
@@ -30,28 +38,82 @@ static const int async_read_expire  =  4 * HZ;	/* ditto for async, these limits
 static const int async_write_expire = 16 * HZ;	/* ditto for async, these limits are SOFT! */
 
 static const int writes_starved = 2;		/* max times reads can starve a write */
-static const int fifo_batch     = 1;		/* # of sequential requests treated as one
+static const int fifo_batch     = 16;		/* # of sequential requests treated as one
 						   by the above parameters. For throughput. */
+static const int sort_requests  = 1;		/* keep a sector sorted tree, to merge and
+						   batch contiguous requests */
 
 /* Elevator data */
 struct sio_data {
 	/* Request queues */
 	struct list_head fifo_list[2][2];
+	struct rb_root sort_list[2];
 
 	/* Attributes */
 	unsigned int batched;
 	unsigned int starved;
+	struct request *next_rq;	/* contiguous to the last dispatched */
 
 	/* Settings */
 	int fifo_expire[2][2];
 	int fifo_batch;
 	int writes_starved;
+	int sort_requests;
 };
 
+/*
+ * Requests are on the sorted tree only if it was enabled when they were
+ * added, so that it can be switched on and off at any time.
+ */
+static inline void
+sio_del_rq_rb(struct sio_data *sd, struct request *rq)
+{
+	if (RB_EMPTY_NODE(&rq->rb_node))
+		return;
+
+	if (sd->next_rq == rq)
+		sd->next_rq = NULL;
+	elv_rb_del(&sd->sort_list[rq_data_dir(rq)], rq);
+}
+
+static int
+sio_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+	struct request *__rq;
+
+	/* Back merges are found by the elevator core */
+	if (!sd->sort_requests)
+		return ELEVATOR_NO_MERGE;
+
+	__rq = elv_rb_find(&sd->sort_list[bio_data_dir(bio)], sector);
+	if (__rq && elv_rq_merge_ok(__rq, bio)) {
+		*req = __rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void
+sio_merged_request(struct request_queue *q, struct request *req, int type)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+
+	/* A front merge moves the request start, reposition it */
+	if (type == ELEVATOR_FRONT_MERGE && !RB_EMPTY_NODE(&req->rb_node)) {
+		elv_rb_del(&sd->sort_list[rq_data_dir(req)], req);
+		elv_rb_add(&sd->sort_list[rq_data_dir(req)], req);
+	}
+}
+
 static void
 sio_merged_requests(struct request_queue *q, struct request *rq,
 		    struct request *next)
 {
+	struct sio_data *sd = q->elevator->elevator_data;
+
 	/*
 	 * If next expires before rq, assign its expire time to rq
 	 * and move into next position (next will be deleted) in fifo.
@@ -65,6 +127,7 @@ sio_merged_requests(struct request_queue *q, struct request *rq,
 
 	/* Delete next request */
 	rq_fifo_clear(next);
+	sio_del_rq_rb(sd, next);
 }
 
 static void
@@ -80,6 +143,9 @@ sio_add_request(struct request_queue *q, struct request *rq)
 	 */
 	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
 	list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+
+	if (sd->sort_requests)
+		elv_rb_add(&sd->sort_list[data_dir], rq);
 }
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
@@ -167,6 +233,20 @@ sio_choose_request(struct sio_data *sd, int data_dir)
 static inline void
 sio_dispatch_request(struct sio_data *sd, struct request *rq)
 {
+	struct request *next = NULL;
+
+	/*
+	 * Remember the request contiguous to this one, if any,
+	 * to dispatch it next.
+	 */
+	if (!RB_EMPTY_NODE(&rq->rb_node)) {
+		next = elv_rb_latter_request(rq->q, rq);
+		if (next && blk_rq_pos(next) != blk_rq_pos(rq) + blk_rq_sectors(rq))
+			next = NULL;
+		sio_del_rq_rb(sd, rq);
+	}
+	sd->next_rq = next;
+
 	/*
 	 * Remove the request from the fifo list
 	 * and dispatch it.
@@ -190,10 +270,12 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	int data_dir = READ;
 
 	/*
-	 * Retrieve any expired request after a batch of
-	 * sequential requests.
+	 * Keep on with a batch of contiguous requests, or retrieve
+	 * any expired request before starting a new one.
 	 */
-	if (sd->batched > sd->fifo_batch) {
+	if (sd->next_rq && sd->batched < sd->fifo_batch) {
+		rq = sd->next_rq;
+	} else {
 		sd->batched = 0;
 		rq = sio_choose_expired_request(sd);
 	}
@@ -221,6 +303,9 @@ sio_former_request(struct request_queue *q, struct request *rq)
 	const int sync = rq_is_sync(rq);
 	const int data_dir = rq_data_dir(rq);
 
+	if (!RB_EMPTY_NODE(&rq->rb_node))
+		return elv_rb_former_request(q, rq);
+
 	if (rq->queuelist.prev == &sd->fifo_list[sync][data_dir])
 		return NULL;
 
@@ -235,6 +320,9 @@ sio_latter_request(struct request_queue *q, struct request *rq)
 	const int sync = rq_is_sync(rq);
 	const int data_dir = rq_data_dir(rq);
 
+	if (!RB_EMPTY_NODE(&rq->rb_node))
+		return elv_rb_latter_request(q, rq);
+
 	if (rq->queuelist.next == &sd->fifo_list[sync][data_dir])
 		return NULL;
 
@@ -257,14 +345,20 @@ sio_init_queue(struct request_queue *q)
 	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
 	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
 	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
+	sd->sort_list[READ] = RB_ROOT;
+	sd->sort_list[WRITE] = RB_ROOT;
 
 	/* Initialize data */
 	sd->batched = 0;
+	sd->starved = 0;
+	sd->next_rq = NULL;
 	sd->fifo_expire[SYNC][READ] = sync_read_expire;
 	sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
 	sd->fifo_expire[ASYNC][READ] = async_read_expire;
 	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
 	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->sort_requests = sort_requests;
 
 	return sd;
 }
@@ -278,6 +372,8 @@ sio_exit_queue(struct elevator_queue *e)
 	BUG_ON(!list_empty(&sd->fifo_list[SYNC][WRITE]));
 	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][READ]));
 	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][WRITE]));
+	BUG_ON(!RB_EMPTY_ROOT(&sd->sort_list[READ]));
+	BUG_ON(!RB_EMPTY_ROOT(&sd->sort_list[WRITE]));
 
 	/* Free structure */
 	kfree(sd);
@@ -317,6 +413,7 @@ SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
 SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
 SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+SHOW_FUNCTION(sio_sort_requests_show, sd->sort_requests, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -341,6 +438,7 @@ STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, IN
 STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
 STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_sort_requests_store, &sd->sort_requests, 0, 1, 0);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -354,11 +452,14 @@ static struct elv_fs_entry sio_attrs[] = {
 	DD_ATTR(async_write_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
+	DD_ATTR(sort_requests),
 	__ATTR_NULL
 };
 
 static struct elevator_type iosched_sio = {
 	.ops = {
+		.elevator_merge_fn		= sio_merge,
+		.elevator_merged_fn		= sio_merged_request,
 		.elevator_merge_req_fn		= sio_merged_requests,
 		.elevator_dispatch_fn		= sio_dispatch_requests,
 		.elevator_add_req_fn		= sio_add_request,
@@ -0,0 +1,427 @@
+/*
+ * drivers/block/null_blk.c
+ *
+ * A block device that stores nothing: every request completes successfully
+ * without moving any data, either right away, from the block softirq or
+ * from a timer after a fixed delay. With the device out of the picture, the
+ * time left is what the block layer and the elevator cost per request, so
+ * this is the device to measure and regression-test I/O schedulers on.
+ *
+ * See Documentation/block/null_blk.txt for the module parameters.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/bio.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+
+enum {
+	NULL_Q_BIO = 0,
+	NULL_Q_RQ = 1,
+	NULL_Q_MQ = 2,
+};
+
+enum {
+	NULL_IRQ_NONE = 0,
+	NULL_IRQ_SOFTIRQ = 1,
+	NULL_IRQ_TIMER = 2,
+};
+
+static int queue_mode = NULL_Q_RQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode,
+		 "0: bio based, 1: request based (default), 2: multi-queue");
+
+static int submit_queues = 1;
+module_param(submit_queues, int, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Hardware contexts in multi-queue mode");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode,
+		 "Completion: 0: inline, 1: softirq (default), 2: timer");
+
+static unsigned long completion_nsec = 10000;
+module_param(completion_nsec, ulong, S_IRUGO);
+MODULE_PARM_DESC(completion_nsec, "Completion delay in timer mode, in ns");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Requests in flight at most (default 64)");
+
+static int nr_devices = 1;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices (default 1)");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Logical block size in bytes (default 512)");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size of each device in GB (default 250)");
+
+struct nullb;
+
+/*
+ * One per tag: what is in flight under it and its completion timer. In
+ * multi-queue mode it is the driver data of each request instead.
+ */
+struct nullb_cmd {
+	struct hrtimer timer;
+	struct nullb *nullb;
+	struct request *rq;
+	struct bio *bio;
+	unsigned int tag;
+};
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+	spinlock_t lock;		/* queue_lock in request mode */
+	struct nullb_cmd *cmds;
+
+	/* tags of the bio mode; the request mode uses the queue's tags */
+	unsigned long *tag_map;
+	wait_queue_head_t tag_wait;
+};
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+
+static unsigned int null_get_tag(struct nullb *nullb)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(nullb->tag_map, hw_queue_depth);
+		if (tag >= hw_queue_depth)
+			return -1U;
+	} while (test_and_set_bit_lock(tag, nullb->tag_map));
+
+	return tag;
+}
+
+static void null_put_tag(struct nullb *nullb, unsigned int tag)
+{
+	clear_bit_unlock(tag, nullb->tag_map);
+	smp_mb__after_clear_bit();
+
+	if (waitqueue_active(&nullb->tag_wait))
+		wake_up(&nullb->tag_wait);
+}
+
+static struct nullb_cmd *null_alloc_cmd(struct nullb *nullb)
+{
+	unsigned int tag;
+
+	wait_event(nullb->tag_wait, (tag = null_get_tag(nullb)) != -1U);
+	return &nullb->cmds[tag];
+}
+
+static void null_end_cmd(struct nullb_cmd *cmd)
+{
+	struct nullb *nullb = cmd->nullb;
+	struct request_queue *q = nullb->q;
+	unsigned long flags;
+
+	switch (queue_mode) {
+	case NULL_Q_RQ:
+		spin_lock_irqsave(q->queue_lock, flags);
+		__blk_end_request_all(cmd->rq, 0);
+		/*
+		 * We stopped the queue when it ran out of tags. This may be
+		 * hardirq context, so let kblockd run it again.
+		 */
+		if (blk_queue_stopped(q)) {
+			queue_flag_clear(QUEUE_FLAG_STOPPED, q);
+			blk_run_queue_async(q);
+		}
+		spin_unlock_irqrestore(q->queue_lock, flags);
+		break;
+	case NULL_Q_BIO:
+		bio_endio(cmd->bio, 0);
+		null_put_tag(nullb, cmd->tag);
+		break;
+	case NULL_Q_MQ:
+		blk_mq_end_io(cmd->rq, 0);
+		break;
+	}
+}
+
+static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+{
+	null_end_cmd(container_of(timer, struct nullb_cmd, timer));
+
+	return HRTIMER_NORESTART;
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	struct nullb *nullb = rq->q->queuedata;
+
+	null_end_cmd(&nullb->cmds[rq->tag]);
+}
+
+static void null_handle_cmd(struct nullb_cmd *cmd)
+{
+	switch (irqmode) {
+	case NULL_IRQ_SOFTIRQ:
+		/*
+		 * A bio has no softirq completion of its own; multi-queue
+		 * completes on the submitting cpu instead.
+		 */
+		if (queue_mode == NULL_Q_RQ) {
+			blk_complete_request(cmd->rq);
+			break;
+		}
+		if (queue_mode == NULL_Q_MQ) {
+			blk_mq_complete_request(cmd->rq);
+			break;
+		}
+		/* fall through */
+	case NULL_IRQ_NONE:
+		null_end_cmd(cmd);
+		break;
+	case NULL_IRQ_TIMER:
+		hrtimer_start(&cmd->timer, ns_to_ktime(completion_nsec),
+			      HRTIMER_MODE_REL);
+		break;
+	}
+}
+
+static int null_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_cmd *cmd;
+
+	cmd = null_alloc_cmd(nullb);
+	cmd->bio = bio;
+	null_handle_cmd(cmd);
+
+	return 0;
+}
+
+/*
+ * Called with the queue lock held. Requests are started as long as there
+ * are tags for them; once there are not, the queue is stopped until a
+ * completion hands one back.
+ */
+static void null_request_fn(struct request_queue *q)
+{
+	struct nullb *nullb = q->queuedata;
+	struct request *rq;
+
+	while ((rq = blk_peek_request(q)) != NULL) {
+		if (blk_queue_start_tag(q, rq)) {
+			blk_stop_queue(q);
+			break;
+		}
+
+		nullb->cmds[rq->tag].rq = rq;
+		spin_unlock_irq(q->queue_lock);
+		null_handle_cmd(&nullb->cmds[rq->tag]);
+		spin_lock_irq(q->queue_lock);
+	}
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	cmd->rq = rq;
+	cmd->nullb = hctx->driver_data;
+	if (irqmode == NULL_IRQ_TIMER) {
+		hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		cmd->timer.function = null_cmd_timer_expired;
+	}
+	null_handle_cmd(cmd);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static const struct block_device_operations null_fops = {
+	.owner = THIS_MODULE,
+};
+
+static int null_setup_cmds(struct nullb *nullb)
+{
+	int i;
+
+	nullb->cmds = kcalloc(hw_queue_depth, sizeof(*nullb->cmds),
+			      GFP_KERNEL);
+	nullb->tag_map = kcalloc(BITS_TO_LONGS(hw_queue_depth),
+				 sizeof(unsigned long), GFP_KERNEL);
+	if (!nullb->cmds || !nullb->tag_map)
+		return -ENOMEM;
+
+	for (i = 0; i < hw_queue_depth; i++) {
+		struct nullb_cmd *cmd = &nullb->cmds[i];
+
+		cmd->nullb = nullb;
+		cmd->tag = i;
+		hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		cmd->timer.function = null_cmd_timer_expired;
+	}
+	init_waitqueue_head(&nullb->tag_wait);
+
+	return 0;
+}
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del(&nullb->list);
+	if (nullb->disk) {
+		del_gendisk(nullb->disk);
+		put_disk(nullb->disk);
+	}
+	if (nullb->q)
+		blk_cleanup_queue(nullb->q);
+	kfree(nullb->tag_map);
+	kfree(nullb->cmds);
+	kfree(nullb);
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct nullb *nullb;
+	struct gendisk *disk;
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+	list_add_tail(&nullb->list, &nullb_list);
+
+	/* multi-queue keeps its commands in the requests */
+	if (queue_mode != NULL_Q_MQ && null_setup_cmds(nullb))
+		goto out;
+
+	if (queue_mode == NULL_Q_MQ) {
+		struct blk_mq_reg reg = {
+			.ops		= &null_mq_ops,
+			.nr_hw_queues	= submit_queues,
+			.queue_depth	= hw_queue_depth,
+			.cmd_size	= sizeof(struct nullb_cmd),
+			.numa_node	= -1,
+			.flags		= BLK_MQ_F_SHOULD_MERGE,
+		};
+
+		nullb->q = blk_mq_init_queue(&reg, nullb);
+		if (!nullb->q)
+			goto out;
+	} else if (queue_mode == NULL_Q_BIO) {
+		nullb->q = blk_alloc_queue(GFP_KERNEL);
+		if (!nullb->q)
+			goto out;
+		blk_queue_make_request(nullb->q, null_make_request);
+	} else {
+		nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+		if (!nullb->q)
+			goto out;
+		blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+		if (blk_queue_init_tags(nullb->q, hw_queue_depth, NULL))
+			goto out;
+	}
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out;
+
+	/* straight to sectors: the byte count overflows a 32-bit sector_t */
+	set_capacity(disk, (sector_t)gb << (30 - 9));
+
+	disk->flags |= GENHD_FL_EXT_DEVT | GENHD_FL_SUPPRESS_PARTITION_INFO;
+	disk->major = null_major;
+	disk->first_minor = index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	sprintf(disk->disk_name, "nullb%d", index);
+	add_disk(disk);
+
+	return 0;
+
+out:
+	null_del_dev(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	int i, ret;
+
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ) {
+		pr_err("null_blk: invalid queue_mode %d\n", queue_mode);
+		return -EINVAL;
+	}
+	if (irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_TIMER) {
+		pr_err("null_blk: invalid irqmode %d\n", irqmode);
+		return -EINVAL;
+	}
+	if (hw_queue_depth < 1 || nr_devices < 1 || gb < 1 ||
+	    submit_queues < 1 || submit_queues > nr_cpu_ids ||
+	    bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs))
+		return -EINVAL;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		ret = null_add_dev(i);
+		if (ret) {
+			while (!list_empty(&nullb_list))
+				null_del_dev(list_entry(nullb_list.next,
+							struct nullb, list));
+			unregister_blkdev(null_major, "nullb");
+			return ret;
+		}
+	}
+
+	pr_info("null_blk: module loaded\n");
+	return 0;
+}
+
+static void __exit null_exit(void)
+{
+	while (!list_empty(&nullb_list))
+		null_del_dev(list_entry(nullb_list.next, struct nullb, list));
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_DESCRIPTION("Memory-less block device for benchmarking the block layer");
+MODULE_LICENSE("GPL");
@@ -53,6 +53,21 @@ struct cpufreq_interactive_cpuinfo {
 	u64 hispeed_validate_time;
 	struct rw_semaphore enable_sem;
 	int governor_enabled;
+	/*
+	 * Busy accounting for cluster_load.  The lock and the next 5
+	 * fields are only used in the cpuinfo of policy->cpu, for the
+	 * whole policy; the lock also protects cluster_busy of every CPU
+	 * of the policy.
+	 */
+	spinlock_t cluster_lock;
+	unsigned int nr_busy;
+	u64 busy_timestamp;
+	u64 busy_cputime;	/* time times the CPUs busy during it */
+	u64 any_busy_time;	/* time at least one CPU was busy */
+	int cluster_busy;	/* this CPU is counted in nr_busy */
+	/* Totals of policy->cpu's cpuinfo at this CPU's last evaluation */
+	u64 busy_cputime_snap;
+	u64 any_busy_time_snap;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -123,6 +138,12 @@ static u64 boostpulse_endtime;
 #define DEFAULT_TIMER_SLACK (4 * DEFAULT_TIMER_RATE)
 static int timer_slack_val = DEFAULT_TIMER_SLACK;
 
+/*
+ * Non-zero means each CPU picks a speed for the load of its whole policy,
+ * rather than for its own load alone.
+ */
+static int cluster_load_val;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -281,6 +302,165 @@ static u64 update_load(int cpu)
 	return now;
 }
 
+static struct cpufreq_interactive_cpuinfo *
+cluster_head(struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	return &per_cpu(cpuinfo, pcpu->policy->cpu);
+}
+
+/* Called with head->cluster_lock held */
+static void cluster_busy_account(struct cpufreq_interactive_cpuinfo *head,
+				 u64 now)
+{
+	u64 delta = now - head->busy_timestamp;
+
+	head->busy_cputime += delta * head->nr_busy;
+	if (head->nr_busy)
+		head->any_busy_time += delta;
+	head->busy_timestamp = now;
+}
+
+/* Count the current CPU in or out of its policy's busy CPUs */
+static void cluster_busy_set(struct cpufreq_interactive_cpuinfo *pcpu,
+			     int busy)
+{
+	struct cpufreq_interactive_cpuinfo *head = cluster_head(pcpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&head->cluster_lock, flags);
+	if (pcpu->cluster_busy != busy) {
+		cluster_busy_account(head, ktime_to_us(ktime_get()));
+		pcpu->cluster_busy = busy;
+		if (busy)
+			head->nr_busy++;
+		else if (head->nr_busy)
+			head->nr_busy--;
+	}
+	spin_unlock_irqrestore(&head->cluster_lock, flags);
+}
+
+/*
+ * Recount the busy CPUs of @policy, for when the idle hooks may not have
+ * been tracking them.  The totals stay monotonic for the snapshots.
+ * Called with gov_lock held.
+ */
+static void cluster_busy_reset(struct cpufreq_policy *policy)
+{
+	struct cpufreq_interactive_cpuinfo *head =
+		&per_cpu(cpuinfo, policy->cpu);
+	unsigned long flags;
+	unsigned int j;
+
+	spin_lock_irqsave(&head->cluster_lock, flags);
+	head->nr_busy = 0;
+	for_each_cpu(j, policy->cpus) {
+		struct cpufreq_interactive_cpuinfo *pjcpu =
+			&per_cpu(cpuinfo, j);
+
+		pjcpu->cluster_busy = !idle_cpu(j);
+		head->nr_busy += pjcpu->cluster_busy;
+	}
+	head->busy_timestamp = ktime_to_us(ktime_get());
+	spin_unlock_irqrestore(&head->cluster_lock, flags);
+}
+
+/*
+ * How many CPUs of the policy were busy at the same time, on average
+ * over the time any of them was, since @pcpu last asked; in FSHIFT fixed
+ * point and at least one.
+ */
+static unsigned long cluster_concurrency(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	struct cpufreq_interactive_cpuinfo *head = cluster_head(pcpu);
+	u64 busy_cputime, any_busy_time;
+	unsigned long flags;
+
+	spin_lock_irqsave(&head->cluster_lock, flags);
+	cluster_busy_account(head, ktime_to_us(ktime_get()));
+	busy_cputime = head->busy_cputime - pcpu->busy_cputime_snap;
+	any_busy_time = head->any_busy_time - pcpu->any_busy_time_snap;
+	pcpu->busy_cputime_snap = head->busy_cputime;
+	pcpu->any_busy_time_snap = head->any_busy_time;
+	spin_unlock_irqrestore(&head->cluster_lock, flags);
+
+	if (!any_busy_time)
+		return 1UL << FSHIFT;
+	return div64_u64(busy_cputime << FSHIFT, any_busy_time);
+}
+
+/*
+ * A burst that migrates between the CPUs of a policy shows up as a part of
+ * the load of each, which none of them would scale up for on its own.  Add
+ * up the load of every CPU in the policy over its current window and spread
+ * it over as many CPUs as were actually busy at the same time, on average:
+ * work that never ran in parallel is sized for one CPU, work that did is
+ * shared out.  The result is never less than the load of the busiest CPU.
+ */
+static unsigned int cluster_loadadjfreq(
+	int cpu, struct cpufreq_interactive_cpuinfo *pcpu,
+	unsigned int loadadjfreq)
+{
+	unsigned int j;
+	unsigned int ncpus = 0;
+	unsigned int max_loadadjfreq = loadadjfreq;
+	unsigned long nr_busy;
+	u64 sum_loadadjfreq = 0;
+	u64 cluster;
+
+	for_each_cpu(j, pcpu->policy->cpus) {
+		struct cpufreq_interactive_cpuinfo *pjcpu =
+			&per_cpu(cpuinfo, j);
+		unsigned int delta_time;
+		unsigned int jloadadjfreq;
+		u64 cputime_speedadj;
+		unsigned long flags;
+		u64 now;
+
+		ncpus++;
+
+		if (j == cpu) {
+			sum_loadadjfreq += loadadjfreq;
+			continue;
+		}
+
+		if (!pjcpu->governor_enabled)
+			continue;
+
+		spin_lock_irqsave(&pjcpu->load_lock, flags);
+		now = update_load(j);
+		delta_time = (unsigned int)
+			(now - pjcpu->cputime_speedadj_timestamp);
+		cputime_speedadj = pjcpu->cputime_speedadj;
+		spin_unlock_irqrestore(&pjcpu->load_lock, flags);
+
+		if (!delta_time)
+			continue;
+
+		do_div(cputime_speedadj, delta_time);
+		jloadadjfreq = (unsigned int)cputime_speedadj * 100;
+		sum_loadadjfreq += jloadadjfreq;
+		if (jloadadjfreq > max_loadadjfreq)
+			max_loadadjfreq = jloadadjfreq;
+	}
+
+	nr_busy = clamp(cluster_concurrency(pcpu), 1UL << FSHIFT,
+			(unsigned long)ncpus << FSHIFT);
+	cluster = div_u64(sum_loadadjfreq << FSHIFT, nr_busy);
+	if (cluster < max_loadadjfreq)
+		cluster = max_loadadjfreq;
+
+	trace_cpufreq_interactive_cluster(
+		cpu, ncpus, loadadjfreq / pcpu->target_freq,
+		max_loadadjfreq / pcpu->target_freq,
+		div_u64(sum_loadadjfreq, pcpu->target_freq),
+		nr_busy * 100 >> FSHIFT,
+		div_u64(cluster, pcpu->target_freq),
+		pcpu->target_freq, pcpu->policy->cur);
+
+	return cluster > UINT_MAX ? UINT_MAX : (unsigned int)cluster;
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	u64 now;
@@ -311,6 +491,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	do_div(cputime_speedadj, delta_time);
 	loadadjfreq = (unsigned int)cputime_speedadj * 100;
+	if (cluster_load_val)
+		loadadjfreq = cluster_loadadjfreq(data, pcpu, loadadjfreq);
 	cpu_load = loadadjfreq / pcpu->target_freq;
 	boosted = boost_val || now < boostpulse_endtime;
 
@@ -420,6 +602,9 @@ static void cpufreq_interactive_idle_start(void)
 		return;
 	}
 
+	if (cluster_load_val)
+		cluster_busy_set(pcpu, 0);
+
 	pending = timer_pending(&pcpu->cpu_timer);
 
 	if (pcpu->target_freq != pcpu->policy->min) {
@@ -450,6 +635,9 @@ static void cpufreq_interactive_idle_end(void)
 		return;
 	}
 
+	if (cluster_load_val)
+		cluster_busy_set(pcpu, 1);
+
 	/* Arm the timer for 1-2 ticks later if not already. */
 	if (!timer_pending(&pcpu->cpu_timer)) {
 		cpufreq_interactive_timer_resched(pcpu);
@@ -987,6 +1175,44 @@ static ssize_t store_boostpulse_duration(
 
 define_one_global_rw(boostpulse_duration);
 
+static ssize_t show_cluster_load(struct kobject *kobj, struct attribute *attr,
+				 char *buf)
+{
+	return sprintf(buf, "%d\n", cluster_load_val);
+}
+
+static ssize_t store_cluster_load(struct kobject *kobj, struct attribute *attr,
+				  const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	unsigned int cpu;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&gov_lock);
+	if (val && !cluster_load_val) {
+		/* The idle hooks start counting now: recount the busy CPUs */
+		cluster_load_val = 1;
+		for_each_online_cpu(cpu) {
+			struct cpufreq_interactive_cpuinfo *pcpu =
+				&per_cpu(cpuinfo, cpu);
+
+			if (pcpu->governor_enabled &&
+			    pcpu->policy->cpu == cpu)
+				cluster_busy_reset(pcpu->policy);
+		}
+	}
+	cluster_load_val = !!val;
+	mutex_unlock(&gov_lock);
+	return count;
+}
+
+define_one_global_rw(cluster_load);
+
 static struct attribute *interactive_attributes[] = {
 	&target_loads_attr.attr,
 	&hispeed_freq_attr.attr,
@@ -999,6 +1225,7 @@ static struct attribute *interactive_attributes[] = {
 	&boost.attr,
 	&boostpulse.attr,
 	&boostpulse_duration.attr,
+	&cluster_load.attr,
 	NULL,
 };
 
@@ -1071,6 +1298,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->governor_enabled = 1;
 			up_write(&pcpu->enable_sem);
 		}
+		cluster_busy_reset(policy);
 
 		/*
 		 * Do not register the idle hook and create sysfs
@@ -1158,6 +1386,7 @@ static int __init cpufreq_interactive_init(void)
 		init_timer(&pcpu->cpu_slack_timer);
 		pcpu->cpu_slack_timer.function = cpufreq_interactive_nop_timer;
 		spin_lock_init(&pcpu->load_lock);
+		spin_lock_init(&pcpu->cluster_lock);
 		init_rwsem(&pcpu->enable_sem);
 	}
 
@@ -205,7 +205,7 @@ static void __init intc_subgroup_map(struct intc_desc_int *d)
 
 restart:
 	nr_found = radix_tree_gang_lookup_tag_slot(&d->tree,
-			(void ***)entries, 0, ARRAY_SIZE(entries),
+			(void ***)entries, NULL, 0, ARRAY_SIZE(entries),
 			INTC_TAG_VIRQ_NEEDS_ALLOC);
 
 	for (i = 0; i < nr_found; i++) {
@@ -25,6 +25,8 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,17 +35,34 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers do not take a lock. Each one claims the next 'len' bytes of the
+ * ring by advancing 'reserve' with cmpxchg, copies its entry in, and then
+ * waits for the writers before it to finish before moving 'w_off' past its
+ * entry, so everything before 'w_off' is complete and in order. Positions
+ * are free-running and only reduced modulo the size to index the buffer.
+ * Both positions live in the control page, which together with the block
+ * table below and the ring itself readers may map read-only and consume
+ * without copying; see struct logger_mmap_ctl.
+ *
+ * Readers are not pulled forward by writers any more: a reader checks after
+ * copying an entry out whether a writer has since claimed that space, and if
+ * so moves itself to the oldest entry that is still intact. To find entries
+ * without walking the ring from an overwritten position, 'starts' holds for
+ * each LOGGER_BLOCK_SIZE bytes of the buffer the position of the first entry
+ * that begins there. 'mutex' serializes the readers and protects 'readers'
+ * and 'head'.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	struct mutex		mutex;	/* mutex protecting readers */
+	struct logger_mmap_ctl	*ctl;	/* write positions, start of mapping */
+	u32			*starts; /* first entry in each block */
+	u32			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
 };
 
@@ -56,11 +75,21 @@ struct logger_log {
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	u32			r_off;	/* current read head position */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	unsigned char		*buf;	/* the entry being read */
 };
 
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/* granularity of logger_log.starts */
+#define LOGGER_BLOCK_SIZE	256
+
+/* payloads up to this size are staged on the writer's stack */
+#define LOGGER_STACK_PAYLOAD	256
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -88,39 +117,65 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * logger_readable - is there a complete entry at position 'pos'? Reads of
+ * the entry must follow this check.
  */
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+static inline bool logger_readable(struct logger_log *log, u32 pos)
 {
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
+	bool ret = (s32)(ACCESS_ONCE(log->ctl->w_off) - pos) > 0;
 
-	return (struct logger_entry *) (log->buffer + off);
+	smp_rmb();
+	return ret;
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
- *
- * Caller needs to hold log->mutex.
+ * logger_lapped - has a writer claimed the space at position 'pos' since it
+ * was written? Checked after copying an entry out to see if the copy is good.
+ */
+static inline bool logger_lapped(struct logger_log *log, u32 pos)
+{
+	smp_rmb();
+	return ACCESS_ONCE(log->ctl->reserve) - pos > log->size;
+}
+
+/*
+ * logger_resync - returns the position of the oldest entry in 'log' that no
+ * writer has claimed the space of. Readers the writers lapped continue from
+ * here, which is where fix_up_readers() used to pull them forward to.
+ */
+static u32 logger_resync(struct logger_log *log)
+{
+	u32 w_off = ACCESS_ONCE(log->ctl->w_off);
+	u32 oldest, base, start;
+
+	smp_rmb();
+	oldest = ACCESS_ONCE(log->ctl->reserve) - log->size;
+	for (base = oldest & ~(LOGGER_BLOCK_SIZE - 1);
+	     (s32)(w_off - base) > 0; base += LOGGER_BLOCK_SIZE) {
+		start = ACCESS_ONCE(log->starts[logger_offset(base) /
+						LOGGER_BLOCK_SIZE]);
+		if (start - base >= LOGGER_BLOCK_SIZE ||
+		    (s32)(start - oldest) < 0)
+			continue;
+		if ((s32)(w_off - start) < 0)
+			break;
+		return start;
+	}
+	return w_off;
+}
+
+/*
+ * copy_from_log - copies 'count' bytes at position 'pos' of 'log' to 'buf'
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static void copy_from_log(struct logger_log *log, u32 pos,
+			  void *buf, size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	size_t off = logger_offset(pos);
+	size_t len = min(count, log->size - off);
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+	memcpy(buf, log->buffer + off, len);
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -156,78 +211,76 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * fetch_entry - copies the next entry 'reader' may read into reader->buf,
+ * skipping the entries of other users unless it can read all of them, and
+ * returns its length including the header, or zero if there is none. The
+ * payload is only copied if 'payload' is set.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static size_t fetch_entry(struct logger_log *log, struct logger_reader *reader,
+			  bool payload)
+{
+	struct logger_entry *entry = (struct logger_entry *) reader->buf;
+
+	while (logger_readable(log, reader->r_off)) {
+		copy_from_log(log, reader->r_off, entry,
+			      sizeof(struct logger_entry));
+		if (logger_lapped(log, reader->r_off) ||
+		    unlikely(entry->len > LOGGER_ENTRY_MAX_PAYLOAD)) {
+			reader->r_off = logger_resync(log);
+			continue;
+		}
+
+		if (!reader->r_all && entry->euid != current_euid()) {
+			reader->r_off += sizeof(struct logger_entry) +
+				entry->len;
+			continue;
+		}
+
+		if (payload) {
+			copy_from_log(log,
+				reader->r_off + sizeof(struct logger_entry),
+				entry->msg, entry->len);
+			if (logger_lapped(log, reader->r_off)) {
+				reader->r_off = logger_resync(log);
+				continue;
+			}
+		}
+
+		return sizeof(struct logger_entry) + entry->len;
+	}
+
+	return 0;
+}
+
+/*
+ * do_read_log_to_user - copies the entry fetched into reader->buf to the
+ * user-space buffer 'buf', which holds exactly 'count' bytes, and moves
+ * the reader past it. Returns 'count' on success.
  *
  * Caller must hold log->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
+static ssize_t do_read_log_to_user(struct logger_reader *reader,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
-	size_t len;
-	size_t msg_start;
+	struct logger_entry *entry = (struct logger_entry *) reader->buf;
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
 
 	/*
 	 * First, copy the header to userspace, using the version of
 	 * the header requested
 	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
 	if (copy_header_to_user(reader->r_ver, entry, buf))
 		return -EFAULT;
 
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(reader->r_off + sizeof(struct logger_entry));
-
-	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
+	if (copy_to_user(buf + hdr_len, entry->msg, count - hdr_len))
 		return -EFAULT;
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
-
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
-
-	return count + get_user_hdr_len(reader->r_ver);
-}
-
-/*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
- */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
-{
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
-
-		entry = get_entry_header(log, off, &scratch);
-
-		if (entry->euid == euid)
-			return off;
-
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(off + next_len);
-	}
+	reader->r_off += sizeof(struct logger_entry) + entry->len;
 
-	return off;
+	return count;
 }
 
 /*
@@ -248,15 +301,14 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
 	ssize_t ret;
+	size_t len;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = !logger_readable(log, reader->r_off);
 		if (!ret)
 			break;
 
@@ -279,26 +331,23 @@ start:
 
 	mutex_lock(&log->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	len = fetch_entry(log, reader, true);
+	if (unlikely(!len)) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + len -
+		sizeof(struct logger_entry);
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(reader, buf, ret);
 
 out:
 	mutex_unlock(&log->mutex);
@@ -307,121 +356,80 @@ out:
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * logger_reserve - claims 'len' bytes of 'log' for an entry and returns the
+ * position of the entry. Does not sleep.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static u32 logger_reserve(struct logger_log *log, size_t len)
 {
-	size_t count = 0;
+	u32 pos, base, old;
+	u32 *start;
 
 	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
+		pos = ACCESS_ONCE(log->ctl->reserve);
+	} while (cmpxchg(&log->ctl->reserve, pos, pos + len) != pos);
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
+	/* record the entry unless an earlier one starts in the same block */
+	start = &log->starts[logger_offset(pos) / LOGGER_BLOCK_SIZE];
+	base = pos & ~(LOGGER_BLOCK_SIZE - 1);
+	do {
+		old = ACCESS_ONCE(*start);
+		if (old - base < LOGGER_BLOCK_SIZE && old <= pos)
+			break;
+	} while (cmpxchg(start, old, pos) != old);
 
-	return 0;
+	return pos;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - makes the entry of 'len' bytes at 'pos' readable once
+ * all entries before it are. The writers before it are running with
+ * preemption disabled as well, so the wait is short.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, u32 pos,
+			  size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	while (ACCESS_ONCE(log->ctl->w_off) != pos)
+		cpu_relax();
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	smp_mb();
+	ACCESS_ONCE(log->ctl->w_off) = pos + len;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, u32 pos,
+			 const void *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
-}
-
-/*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
- */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is copied in from user space before any space in the log is
+ * claimed, so a fault can not leave a hole in the log and nothing between
+ * claiming the space and committing the entry sleeps.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	unsigned char stack_payload[LOGGER_STACK_PAYLOAD];
+	unsigned char *payload = stack_payload;
 	struct logger_entry header;
 	struct timespec now;
+	u32 pos;
+	size_t len;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -438,41 +446,43 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	if (header.len > LOGGER_STACK_PAYLOAD) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (!payload)
+			return -ENOMEM;
+	}
 
+	while (nr_segs-- > 0 && ret < header.len) {
 		/* figure out how much of this vector we can keep */
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (copy_from_user(payload + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
+	header.len = ret;
+
+	len = sizeof(struct logger_entry) + header.len;
+	preempt_disable();
+	pos = logger_reserve(log, len);
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos + sizeof(struct logger_entry), payload,
+		     header.len);
+	logger_commit(log, pos, len);
+	preempt_enable();
+
+	/* wake up any blocked readers; pairs with prepare_to_wait() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+out:
+	if (payload != stack_payload)
+		kfree(payload);
 
 	return ret;
 }
@@ -504,6 +514,12 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->buf = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->buf) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
@@ -512,6 +528,8 @@ static int logger_open(struct inode *inode, struct file *file)
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
+		if (logger_lapped(log, log->head))
+			log->head = logger_resync(log);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
@@ -532,7 +550,12 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		mutex_lock(&log->mutex);
 		list_del(&reader->list);
+		mutex_unlock(&log->mutex);
+		kfree(reader->buf);
 		kfree(reader);
 	}
 
@@ -563,11 +586,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	if (fetch_entry(log, reader, false))
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -587,6 +606,27 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	return 0;
 }
 
+/*
+ * logger_set_read_pos - moves a reader that consumed the log through the
+ * mapping to 'arg', which must lie between the oldest intact entry and the
+ * write head. Only readers that may see every entry get here, as nothing
+ * checks that 'arg' starts an entry. Caller needs to hold log->mutex.
+ */
+static long logger_set_read_pos(struct logger_log *log,
+				struct logger_reader *reader, void __user *arg)
+{
+	u32 pos;
+
+	if (copy_from_user(&pos, arg, sizeof(u32)))
+		return -EFAULT;
+
+	if ((s32)(ACCESS_ONCE(log->ctl->w_off) - pos) < 0)
+		return -EINVAL;
+
+	reader->r_off = logger_lapped(log, pos) ? logger_resync(log) : pos;
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
@@ -606,10 +646,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		if (logger_lapped(log, reader->r_off))
+			reader->r_off = logger_resync(log);
+		ret = ACCESS_ONCE(log->ctl->w_off) - reader->r_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -618,24 +657,19 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
-		else
-			ret = 0;
+		ret = fetch_entry(log, reader, false);
+		if (ret)
+			ret += get_user_hdr_len(reader->r_ver) -
+				sizeof(struct logger_entry);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
+		log->head = ACCESS_ONCE(log->ctl->w_off);
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			reader->r_off = log->head;
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -654,6 +688,37 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_GET_READ_POS:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		/*
+		 * Only for mmap readers: positions are not checked to start
+		 * an entry, so a filtered reader could seek onto a header
+		 * it forged in its own payload and defeat the uid filter.
+		 */
+		if (!reader->r_all) {
+			ret = -EPERM;
+			break;
+		}
+		if (logger_lapped(log, reader->r_off))
+			reader->r_off = logger_resync(log);
+		ret = put_user(reader->r_off, (u32 __user *) argp);
+		break;
+	case LOGGER_SET_READ_POS:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		if (!reader->r_all) {
+			ret = -EPERM;
+			break;
+		}
+		ret = logger_set_read_pos(log, reader, argp);
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -661,9 +726,34 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the control page, the block table and the ring read-only, for
+ * readers that may see every entry.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	if (!reader->r_all)
+		return -EPERM;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, reader->log->ctl, vma->vm_pgoff);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
+	.mmap = logger_mmap,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
@@ -678,9 +768,7 @@ static const struct file_operations logger_fops = {
  * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -690,7 +778,6 @@ static struct logger_log VAR = { \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -715,12 +802,29 @@ static struct logger_log *get_log_from_minor(int minor)
 
 static int __init init_log(struct logger_log *log)
 {
+	size_t starts_size;
 	int ret;
 
+	/* the control page, the block table and the ring, in one mapping */
+	starts_size = PAGE_ALIGN(log->size / LOGGER_BLOCK_SIZE * sizeof(u32));
+	log->ctl = vmalloc_user(PAGE_SIZE + starts_size + log->size);
+	if (!log->ctl)
+		return -ENOMEM;
+	log->starts = (void *) log->ctl + PAGE_SIZE;
+	log->buffer = (void *) log->starts + starts_size;
+
+	log->ctl->version = LOGGER_MMAP_VERSION;
+	log->ctl->size = log->size;
+	log->ctl->block_size = LOGGER_BLOCK_SIZE;
+	log->ctl->starts_offset = PAGE_SIZE;
+	log->ctl->data_offset = PAGE_SIZE + starts_size;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(log->ctl);
+		log->ctl = NULL;
 		return ret;
 	}
 
@@ -58,6 +58,39 @@ struct logger_entry {
 
 #define LOGGER_ENTRY_MAX_PAYLOAD	4076
 
+/*
+ * A reader that may read all entries can also map a log read-only with
+ * mmap() and consume it in place. The mapping holds, from offset 0:
+ *
+ *	struct logger_mmap_ctl, in a page of its own
+ *	at starts_offset, one __u32 for each block_size bytes of the ring:
+ *		the position of the first entry that starts in that block
+ *	at data_offset, the ring: 'size' bytes of version 2 entries, each
+ *		a struct logger_entry followed by its payload
+ *
+ * Positions run freely and wrap at 2^32; position p is at byte
+ * (p & (size - 1)) of the ring. The entries before w_off are complete.
+ * Read w_off before reading entries, and reserve after them: an entry
+ * copied from position p is good if reserve - p <= size, otherwise a
+ * writer has overwritten it and the reader goes on from the first block
+ * table position at or after reserve - size. LOGGER_GET_READ_POS gives
+ * the position to start from, and a reader that reports how far it got
+ * with LOGGER_SET_READ_POS can then poll() for newer entries. Like the
+ * mapping itself, both ioctls are only allowed to readers that may see
+ * every entry.
+ */
+#define LOGGER_MMAP_VERSION	1
+
+struct logger_mmap_ctl {
+	__u32		version;	/* LOGGER_MMAP_VERSION */
+	__u32		size;		/* size of the ring */
+	__u32		block_size;	/* ring bytes per block table entry */
+	__u32		starts_offset;	/* offset of the block table */
+	__u32		data_offset;	/* offset of the ring */
+	__u32		reserve;	/* writers have claimed up to here */
+	__u32		w_off;		/* entries before this are complete */
+};
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
@@ -66,5 +99,7 @@ struct logger_entry {
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
 #define LOGGER_GET_VERSION		_IO(__LOGGERIO, 5) /* abi version */
 #define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6) /* abi version */
+#define LOGGER_GET_READ_POS		_IOR(__LOGGERIO, 7, __u32) /* mmap */
+#define LOGGER_SET_READ_POS		_IOW(__LOGGERIO, 8, __u32) /* mmap */
 
 #endif /* _LINUX_LOGGER_H */
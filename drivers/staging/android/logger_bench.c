@@ -0,0 +1,171 @@
+/*
+ * drivers/staging/android/logger_bench.c
+ *
+ * Measures how many entries a second the log driver takes as the number of
+ * concurrent writers grows. On load it runs one round for each writer count
+ * from 1 to 'writers', each round lasting 'duration_ms', with every writer a
+ * kernel thread writing 'size' byte messages to 'log' as fast as it can, and
+ * prints the rate of each round. Like tcrypt, it then fails to load so it
+ * can be run again with other parameters.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/uaccess.h>
+
+static char *log_path = "/dev/log/main";
+module_param_named(log, log_path, charp, S_IRUGO);
+static int max_writers = 4;
+module_param_named(writers, max_writers, int, S_IRUGO);
+static int duration_ms = 1000;
+module_param_named(duration_ms, duration_ms, int, S_IRUGO);
+static int msg_size = 64;
+module_param_named(size, msg_size, int, S_IRUGO);
+
+static const char bench_tag[] = "logger_bench";
+
+struct bench_writer {
+	struct task_struct *task;
+	struct file *filp;
+	unsigned long writes;
+	int err;
+};
+
+static char *bench_msg;
+static size_t bench_msg_len;
+
+static int bench_writer_thread(void *data)
+{
+	struct bench_writer *w = data;
+	mm_segment_t old_fs = get_fs();
+	loff_t pos = 0;
+	ssize_t ret;
+
+	set_fs(KERNEL_DS);
+	while (!kthread_should_stop()) {
+		ret = vfs_write(w->filp, (const char __user *)bench_msg,
+				bench_msg_len, &pos);
+		if (ret < 0) {
+			w->err = ret;
+			break;
+		}
+		w->writes++;
+		cond_resched();
+	}
+	set_fs(old_fs);
+
+	/* kthread_stop() must find us alive */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static int bench_round(struct bench_writer *w, int nr)
+{
+	unsigned long writes = 0;
+	int i, ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		w[i].writes = 0;
+		w[i].err = 0;
+		w[i].task = kthread_create(bench_writer_thread, &w[i],
+					   "logger_bench/%d", i);
+		if (IS_ERR(w[i].task)) {
+			ret = PTR_ERR(w[i].task);
+			nr = i;
+			goto stop;
+		}
+	}
+	for (i = 0; i < nr; i++)
+		wake_up_process(w[i].task);
+
+	msleep(duration_ms);
+
+stop:
+	for (i = 0; i < nr; i++) {
+		kthread_stop(w[i].task);
+		writes += w[i].writes;
+		if (w[i].err && !ret)
+			ret = w[i].err;
+	}
+	if (ret)
+		return ret;
+
+	printk(KERN_INFO "logger_bench: %d writer%s: %lu writes/s\n",
+	       nr, nr == 1 ? "" : "s", writes * 1000 / duration_ms);
+	return 0;
+}
+
+static int __init logger_bench_init(void)
+{
+	struct bench_writer *w;
+	int i, nr, ret = 0;
+
+	if (max_writers < 1 || duration_ms < 1 || msg_size < 1)
+		return -EINVAL;
+
+	w = kcalloc(max_writers, sizeof(*w), GFP_KERNEL);
+	/* priority, tag and message, as liblog writes them */
+	bench_msg_len = 1 + sizeof(bench_tag) + msg_size;
+	bench_msg = kmalloc(bench_msg_len, GFP_KERNEL);
+	if (!w || !bench_msg) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	bench_msg[0] = 2; /* verbose */
+	memcpy(bench_msg + 1, bench_tag, sizeof(bench_tag));
+	memset(bench_msg + 1 + sizeof(bench_tag), 'x', msg_size - 1);
+	bench_msg[bench_msg_len - 1] = '\0';
+
+	for (nr = 0; nr < max_writers; nr++) {
+		w[nr].filp = filp_open(log_path, O_WRONLY, 0);
+		if (IS_ERR(w[nr].filp)) {
+			ret = PTR_ERR(w[nr].filp);
+			printk(KERN_ERR "logger_bench: can not open %s: %d\n",
+			       log_path, ret);
+			goto close;
+		}
+	}
+
+	printk(KERN_INFO "logger_bench: %d byte entries to %s for %d ms\n",
+	       (int)bench_msg_len, log_path, duration_ms);
+	for (i = 1; i <= max_writers && !ret; i++)
+		ret = bench_round(w, i);
+
+close:
+	while (nr--)
+		filp_close(w[nr].filp, NULL);
+out:
+	kfree(bench_msg);
+	kfree(w);
+	return ret ? ret : -EAGAIN;
+}
+
+static void __exit logger_bench_exit(void)
+{
+}
+
+module_init(logger_bench_init);
+module_exit(logger_bench_exit);
+
+MODULE_DESCRIPTION("Android log driver write benchmark");
+MODULE_LICENSE("GPL");
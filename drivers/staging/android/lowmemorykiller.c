@@ -16,6 +16,13 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * With /sys/module/lowmemorykiller/parameters/pressure_mode set, the free
+ * memory thresholds only give the starting point and the reclaim efficiency
+ * decides: while reclaim frees most of what it scans no process above the
+ * lowest threshold is killed, and once it stops freeing memory (pressure at
+ * or above pressure_critical percent) or pages are swapped back in faster
+ * than swapin_critical pages a second, the next lower oom_adj level is used.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -37,6 +44,12 @@
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
 #include <linux/compaction.h>
+#include <linux/rculist_nulls.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -54,6 +67,11 @@ static int lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+static int lowmem_pressure_mode;
+static int lowmem_pressure_medium = 60;
+static int lowmem_pressure_critical = 95;
+static int lowmem_swapin_critical = 2048;
+
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
@@ -83,16 +101,275 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+struct lowmem_victim {
+	struct task_struct *task;
+	int tasksize;
+	int oom_adj;
+};
+
+/*
+ * Make tsk the victim if it is a better one than the current selection:
+ * a higher oom_adj first, then a larger rss. Called under rcu_read_lock().
+ */
+static void lowmem_check_task(struct task_struct *tsk, int min_adj,
+			      struct lowmem_victim *v)
+{
+	struct task_struct *p;
+	int oom_adj;
+	int tasksize;
+
+	if (tsk->flags & PF_KTHREAD)
+		return;
+
+	p = find_lock_task_mm(tsk);
+	if (!p)
+		return;
+
+	oom_adj = p->signal->oom_adj;
+	if (oom_adj < min_adj) {
+		task_unlock(p);
+		return;
+	}
+	tasksize = get_mm_rss(p->mm);
+	task_unlock(p);
+	if (tasksize <= 0)
+		return;
+	if (v->task) {
+		if (oom_adj < v->oom_adj)
+			return;
+		if (oom_adj == v->oom_adj && tasksize <= v->tasksize)
+			return;
+	}
+	v->task = p;
+	v->tasksize = tasksize;
+	v->oom_adj = oom_adj;
+	lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+		     p->pid, p->comm, oom_adj, tasksize);
+}
+
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+/*
+ * Every thread group leader sits on the bucket of its oom_adj, so the
+ * victim is found by walking down from the highest bucket and stopping
+ * at the first one with a killable process.
+ *
+ * The buckets are walked under RCU. A process that changes bucket while
+ * a reader is on it can take the reader along to its new bucket, so
+ * moves are done under lowmem_adj_seq and the reader rescans when one
+ * raced with it; all buckets end in the same nulls marker so the walk
+ * always terminates. The bucket is only a hint: lowmem_check_task()
+ * still compares the live oom_adj.
+ */
+static struct hlist_nulls_head lowmem_adj_buckets[LOWMEM_ADJ_BUCKETS] = {
+	[0 ... LOWMEM_ADJ_BUCKETS - 1] = {
+		.first = (struct hlist_nulls_node *)1UL, /* nulls value 0 */
+	}
+};
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+static seqcount_t lowmem_adj_seq = SEQCNT_ZERO;
+
+static struct hlist_nulls_head *lowmem_adj_bucket(int oom_adj)
+{
+	return &lowmem_adj_buckets[clamp(oom_adj, OOM_DISABLE,
+					 OOM_ADJUST_MAX) - OOM_DISABLE];
+}
+
+void lowmem_adj_add(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	hlist_nulls_add_head_rcu(&p->lmk_adj_node,
+				 lowmem_adj_bucket(p->signal->oom_adj));
+	spin_unlock(&lowmem_adj_lock);
+}
+
+void lowmem_adj_del(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	hlist_nulls_del_init_rcu(&p->lmk_adj_node);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/* exec() made new the leader of old's thread group */
+void lowmem_adj_replace(struct task_struct *old, struct task_struct *new)
+{
+	spin_lock(&lowmem_adj_lock);
+	hlist_nulls_del_init_rcu(&old->lmk_adj_node);
+	hlist_nulls_add_head_rcu(&new->lmk_adj_node,
+				 lowmem_adj_bucket(new->signal->oom_adj));
+	spin_unlock(&lowmem_adj_lock);
+}
+
+void lowmem_adj_update(struct task_struct *p)
+{
+	struct task_struct *leader = p->group_leader;
+
+	spin_lock(&lowmem_adj_lock);
+	if (!hlist_nulls_unhashed(&leader->lmk_adj_node)) {
+		write_seqcount_begin(&lowmem_adj_seq);
+		hlist_nulls_del_rcu(&leader->lmk_adj_node);
+		hlist_nulls_add_head_rcu(&leader->lmk_adj_node,
+				lowmem_adj_bucket(leader->signal->oom_adj));
+		write_seqcount_end(&lowmem_adj_seq);
+	}
+	spin_unlock(&lowmem_adj_lock);
+}
+
+static int lowmem_select(int min_adj, struct lowmem_victim *v)
+{
+	struct task_struct *tsk;
+	struct hlist_nulls_node *pos;
+	struct hlist_nulls_head *head;
+	unsigned seq;
+	int scanned = 0;
+	int adj;
+
+	for (adj = OOM_ADJUST_MAX; adj >= max(min_adj, OOM_DISABLE); adj--) {
+		head = lowmem_adj_bucket(adj);
+		do {
+			seq = read_seqcount_begin(&lowmem_adj_seq);
+			hlist_nulls_for_each_entry_rcu(tsk, pos, head,
+						       lmk_adj_node) {
+				lowmem_check_task(tsk, min_adj, v);
+				scanned++;
+			}
+		} while (read_seqcount_retry(&lowmem_adj_seq, seq));
+		if (v->task)
+			break;
+	}
+	return scanned;
+}
+#else
+static int lowmem_select(int min_adj, struct lowmem_victim *v)
 {
 	struct task_struct *tsk;
-	struct task_struct *selected = NULL;
+	int scanned = 0;
+
+	for_each_process(tsk) {
+		lowmem_check_task(tsk, min_adj, v);
+		scanned++;
+	}
+	return scanned;
+}
+#endif
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/* Pages reclaim has to scan before the pressure is recomputed */
+#define LOWMEM_PRESSURE_WINDOW	(SWAP_CLUSTER_MAX * 16)
+
+/*
+ * Reclaim efficiency over the last window, from the counters vmscan
+ * keeps: pressure is the percentage of scanned pages that could not be
+ * reclaimed, as in vmpressure.
+ */
+static struct {
+	spinlock_t lock;
+	unsigned long stamp;
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long swapin;
+	int pressure;
+	unsigned long swapin_rate;
+} lowmem_pressure = {
+	.lock = __SPIN_LOCK_UNLOCKED(lowmem_pressure.lock),
+};
+
+static unsigned long lowmem_sum_events(int first, int last)
+{
+	unsigned long sum = 0;
+	int cpu, i;
+
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = first; i <= last; i++)
+			sum += this->event[i];
+	}
+	return sum;
+}
+
+static void lowmem_pressure_update(void)
+{
+	unsigned long scanned, reclaimed, swapin, elapsed;
+
+	if (!spin_trylock(&lowmem_pressure.lock))
+		return;
+	scanned = lowmem_sum_events(PGSTEAL_MOVABLE + 1, PGSCAN_DIRECT_MOVABLE);
+	reclaimed = lowmem_sum_events(PGREFILL_MOVABLE + 1, PGSTEAL_MOVABLE);
+	swapin = lowmem_sum_events(PSWPIN, PSWPIN);
+	elapsed = jiffies - lowmem_pressure.stamp;
+
+	if (scanned - lowmem_pressure.scanned >= LOWMEM_PRESSURE_WINDOW) {
+		unsigned long ds = scanned - lowmem_pressure.scanned;
+		unsigned long dr = reclaimed - lowmem_pressure.reclaimed;
+
+		lowmem_pressure.pressure = 100 - min(dr, ds) * 100 / ds;
+	} else if (elapsed >= HZ) {
+		/* reclaim hardly ran for a second */
+		lowmem_pressure.pressure = 0;
+	} else {
+		spin_unlock(&lowmem_pressure.lock);
+		return;
+	}
+	lowmem_pressure.swapin_rate = elapsed ?
+		(swapin - lowmem_pressure.swapin) * HZ / elapsed : 0;
+	trace_lowmemory_pressure(lowmem_pressure.pressure,
+				 lowmem_pressure.swapin_rate,
+				 scanned - lowmem_pressure.scanned,
+				 reclaimed - lowmem_pressure.reclaimed);
+	lowmem_pressure.stamp += elapsed;
+	lowmem_pressure.scanned = scanned;
+	lowmem_pressure.reclaimed = reclaimed;
+	lowmem_pressure.swapin = swapin;
+	spin_unlock(&lowmem_pressure.lock);
+}
+
+/*
+ * Adjust the oom_adj the free memory thresholds picked (level is the
+ * index of the threshold that was crossed, array_size if none was) by
+ * how well reclaim is doing.
+ */
+static int lowmem_pressure_min_adj(int level, int array_size, int min_adj)
+{
+	int pressure;
+	unsigned long swapin_rate;
+
+	if (!array_size)
+		return min_adj;
+
+	lowmem_pressure_update();
+	pressure = lowmem_pressure.pressure;
+	swapin_rate = lowmem_pressure.swapin_rate;
+
+	if (pressure >= lowmem_pressure_critical ||
+	    swapin_rate >= lowmem_swapin_critical) {
+		level = level ? level - 1 : 0;
+		lowmem_print(3, "lowmem_shrink pressure %d swapin %lu, "
+			     "escalate to adj %d\n", pressure, swapin_rate,
+			     lowmem_adj[level]);
+		return lowmem_adj[level];
+	}
+	if (pressure < lowmem_pressure_medium && level > 0)
+		return OOM_ADJUST_MAX + 1;
+	return min_adj;
+}
+#else
+static int lowmem_pressure_min_adj(int level, int array_size, int min_adj)
+{
+	return min_adj;
+}
+#endif
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct lowmem_victim victim = { .task = NULL };
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
+	int scanned;
+	u64 start;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -120,6 +397,8 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	if (lowmem_pressure_mode)
+		min_adj = lowmem_pressure_min_adj(i, array_size, min_adj);
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -133,50 +412,22 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
 	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_adj = p->signal->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
+	start = local_clock();
+	scanned = lowmem_select(min_adj, &victim);
+	trace_lowmemory_scan(min_adj, scanned, local_clock() - start);
+	selected = victim.task;
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
+			     victim.oom_adj, victim.tasksize);
+		trace_lowmemory_kill(selected, victim.oom_adj, min_adj,
+				     victim.tasksize, other_free, other_file);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		send_sig(SIGKILL, selected, 0);
-		rem -= selected_tasksize;
+		rem -= victim.tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
@@ -210,6 +461,13 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, int, S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(swapin_critical, lowmem_swapin_critical, int,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,98 @@
+/*
+ * Trace events for the low memory killer.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Cost of one victim search: tasks looked at and time spent */
+TRACE_EVENT(lowmemory_scan,
+	TP_PROTO(int min_adj, int scanned, u64 duration_ns),
+	TP_ARGS(min_adj, scanned, duration_ns),
+	TP_STRUCT__entry(
+		__field(int, min_adj)
+		__field(int, scanned)
+		__field(u64, duration_ns)
+	),
+	TP_fast_assign(
+		__entry->min_adj = min_adj;
+		__entry->scanned = scanned;
+		__entry->duration_ns = duration_ns;
+	),
+	TP_printk("min_adj=%d scanned=%d duration=%lluns",
+		  __entry->min_adj, __entry->scanned, __entry->duration_ns)
+);
+
+TRACE_EVENT(lowmemory_kill,
+	TP_PROTO(struct task_struct *killed_task, int oom_adj, int min_adj,
+		 int tasksize, int other_free, int other_file),
+	TP_ARGS(killed_task, oom_adj, min_adj, tasksize, other_free,
+		other_file),
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, oom_adj)
+		__field(int, min_adj)
+		__field(int, tasksize)
+		__field(int, other_free)
+		__field(int, other_file)
+	),
+	TP_fast_assign(
+		memcpy(__entry->comm, killed_task->comm, TASK_COMM_LEN);
+		__entry->pid = killed_task->pid;
+		__entry->oom_adj = oom_adj;
+		__entry->min_adj = min_adj;
+		__entry->tasksize = tasksize;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+	),
+	TP_printk("%s pid=%d adj=%d min_adj=%d size=%d free=%d file=%d",
+		  __entry->comm, __entry->pid, __entry->oom_adj,
+		  __entry->min_adj, __entry->tasksize, __entry->other_free,
+		  __entry->other_file)
+);
+
+/* Reclaim efficiency over the last window, in pressure mode */
+TRACE_EVENT(lowmemory_pressure,
+	TP_PROTO(int pressure, unsigned long swapin_rate,
+		 unsigned long scanned, unsigned long reclaimed),
+	TP_ARGS(pressure, swapin_rate, scanned, reclaimed),
+	TP_STRUCT__entry(
+		__field(int, pressure)
+		__field(unsigned long, swapin_rate)
+		__field(unsigned long, scanned)
+		__field(unsigned long, reclaimed)
+	),
+	TP_fast_assign(
+		__entry->pressure = pressure;
+		__entry->swapin_rate = swapin_rate;
+		__entry->scanned = scanned;
+		__entry->reclaimed = reclaimed;
+	),
+	TP_printk("pressure=%d swapin=%lu/s scanned=%lu reclaimed=%lu",
+		  __entry->pressure, __entry->swapin_rate,
+		  __entry->scanned, __entry->reclaimed)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+#include <trace/define_trace.h>
@@ -6,12 +6,13 @@
  *
  * Zcache provides an in-kernel "host implementation" for transcendent memory
  * and, thus indirectly, for cleancache and frontswap.  Zcache includes two
- * page-accessible memory [1] interfaces, both utilizing lzo1x compression:
+ * page-accessible memory [1] interfaces, both compressing through the
+ * crypto API (lzo1x unless chosen otherwise at boot):
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
  * 2) xvmalloc is used for persistent pages.
  * Xvmalloc (based on the TLSF allocator) has very low fragmentation
- * so maximizes space efficiency, while zbud allows pairs (and potentially,
- * in the future, more than a pair of) compressed pages to be closely linked
+ * so maximizes space efficiency, while zbud packs as many compressed
+ * pages as fit into each physical page and keeps them closely linked
  * so that reclaiming can be done via the kernel's physical-page-oriented
  * "shrinker" interface.
  *
@@ -23,7 +24,7 @@
 #include <linux/cpu.h>
 #include <linux/highmem.h>
 #include <linux/list.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -82,42 +83,46 @@ static inline bool is_local_client(struct zcache_client *cli)
 }
 
 /**********
- * Compression buddies ("zbud") provides for packing two (or, possibly
- * in the future, more) compressed ephemeral pages into a single "raw"
- * (physical) page and tracking them with data structures so that
- * the raw pages can be easily reclaimed.
+ * Compression buddies ("zbud") provides for packing any number of
+ * compressed ephemeral pages into a single "raw" (physical) page and
+ * tracking them with data structures so that the raw pages can be easily
+ * reclaimed.
  *
- * A zbud page ("zbpg") is an aligned page containing a list_head,
- * a lock, and two "zbud headers".  The remainder of the physical
- * page is divided up into aligned 64-byte "chunks" which contain
- * the compressed data for zero, one, or two zbuds.  Each zbpg
- * resides on: (1) an "unused list" if it has no zbuds; (2) a
- * "buddied" list if it is fully populated  with two zbuds; or
- * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
- * the one unbuddied zbud uses.  The data inside a zbpg cannot be
- * read or written unless the zbpg's lock is held.
+ * A zbud page ("zbpg") is an aligned page containing a list_head, a lock
+ * and an array of "zbud headers" that grows up from the start of the page,
+ * while the compressed data, in aligned 64-byte "chunks", grows down from
+ * the end of the page.  Zbuds are added for as long as headers and data do
+ * not meet.  Freeing a zbud slides the data below it up, so the free space
+ * is always the single gap in the middle; headers never move, so they can
+ * serve as the pampd.  Each zbpg resides on: (1) an "unused list" if it
+ * has no zbuds; (2) a "buddied" list if it has no room for another zbud;
+ * or (3) one of NCHUNKS "unbuddied" lists indexed by how many chunks it
+ * has in use, counting the header the next zbud will need.  The data
+ * inside a zbpg cannot be read or written unless the zbpg's lock is held.
  */
 
 #define ZBH_SENTINEL  0x43214321
 #define ZBPG_SENTINEL  0xdeadbeef
 
-#define ZBUD_MAX_BUDS 2
-
 struct zbud_hdr {
 	uint16_t client_id;
 	uint16_t pool_id;
 	struct tmem_oid oid;
 	uint32_t index;
 	uint16_t size; /* compressed size in bytes, zero means unused */
+	uint16_t offset; /* of the compressed data within the zbpg */
 	DECL_SENTINEL
 };
 
 struct zbud_page {
 	struct list_head bud_list;
 	spinlock_t lock;
-	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
+	uint16_t nr_hdrs; /* headers in buddy[], used or not */
+	uint16_t nr_buds; /* headers in use */
+	uint16_t data_start; /* offset of the lowest data chunk */
 	DECL_SENTINEL
-	/* followed by NUM_CHUNK aligned CHUNK_SIZE-byte chunks */
+	struct zbud_hdr buddy[0];
+	/* data chunks are packed at the end of the page */
 };
 
 #define CHUNK_SHIFT	6
@@ -158,6 +163,7 @@ static unsigned long zcache_mean_compress_poor;
 /* forward references */
 static void *zcache_get_free_page(void);
 static void zcache_free_page(void *p);
+static int zcache_decompress(char *from_va, unsigned size, char *to_va);
 
 /*
  * zbud helper functions
@@ -165,7 +171,8 @@ static void zcache_free_page(void *p);
 
 static inline unsigned zbud_max_buddy_size(void)
 {
-	return MAX_CHUNK << CHUNK_SHIFT;
+	return (PAGE_SIZE - sizeof(struct zbud_page) -
+		sizeof(struct zbud_hdr)) & CHUNK_MASK;
 }
 
 static inline unsigned zbud_size_to_chunks(unsigned size)
@@ -174,40 +181,66 @@ static inline unsigned zbud_size_to_chunks(unsigned size)
 	return (size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
 }
 
-static inline int zbud_budnum(struct zbud_hdr *zh)
+static inline struct zbud_page *zbud_page(struct zbud_hdr *zh)
 {
-	unsigned offset = (unsigned long)zh & (PAGE_SIZE - 1);
-	struct zbud_page *zbpg = NULL;
-	unsigned budnum = -1U;
-	int i;
+	return (struct zbud_page *)((unsigned long)zh & PAGE_MASK);
+}
 
-	for (i = 0; i < ZBUD_MAX_BUDS; i++)
-		if (offset == offsetof(typeof(*zbpg), buddy[i])) {
-			budnum = i;
-			break;
-		}
-	BUG_ON(budnum == -1U);
-	return budnum;
+/* chunks of data that still fit, after a header for them if need be */
+static unsigned zbud_free_chunks(struct zbud_page *zbpg)
+{
+	unsigned hdr_end = sizeof(struct zbud_page) +
+				zbpg->nr_hdrs * sizeof(struct zbud_hdr);
+
+	if (zbpg->nr_buds == zbpg->nr_hdrs)
+		hdr_end += sizeof(struct zbud_hdr);
+	if (hdr_end >= zbpg->data_start)
+		return 0;
+	return (zbpg->data_start - hdr_end) >> CHUNK_SHIFT;
+}
+
+/* unbuddied list the zbpg belongs on, or -1 for the buddied list */
+static int zbud_list_index(struct zbud_page *zbpg)
+{
+	unsigned free_chunks = zbud_free_chunks(zbpg);
+
+	return free_chunks ? NCHUNKS - free_chunks : -1;
+}
+
+/* must hold zbpg->lock and zbud_budlists_spinlock */
+static void zbud_list_add(struct zbud_page *zbpg)
+{
+	int i = zbud_list_index(zbpg);
+
+	if (i < 0) {
+		list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
+		zcache_zbud_buddied_count++;
+	} else {
+		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[i].list);
+		zbud_unbuddied[i].count++;
+	}
+}
+
+/* must hold zbpg->lock and zbud_budlists_spinlock */
+static void zbud_list_del(struct zbud_page *zbpg)
+{
+	int i = zbud_list_index(zbpg);
+
+	list_del_init(&zbpg->bud_list);
+	if (i < 0)
+		zcache_zbud_buddied_count--;
+	else
+		zbud_unbuddied[i].count--;
 }
 
 static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 {
-	struct zbud_page *zbpg;
-	char *p;
-	unsigned budnum;
+	struct zbud_page *zbpg = zbud_page(zh);
 
 	ASSERT_SENTINEL(zh, ZBH);
-	budnum = zbud_budnum(zh);
 	BUG_ON(size == 0 || size > zbud_max_buddy_size());
-	zbpg = container_of(zh, struct zbud_page, buddy[budnum]);
 	ASSERT_SPINLOCK(&zbpg->lock);
-	p = (char *)zbpg;
-	if (budnum == 0)
-		p += ((sizeof(struct zbud_page) + CHUNK_SIZE - 1) &
-							CHUNK_MASK);
-	else if (budnum == 1)
-		p += PAGE_SIZE - ((size + CHUNK_SIZE - 1) & CHUNK_MASK);
-	return p;
+	return (char *)zbpg + zh->offset;
 }
 
 /*
@@ -217,7 +250,6 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 static struct zbud_page *zbud_alloc_raw_page(void)
 {
 	struct zbud_page *zbpg = NULL;
-	struct zbud_hdr *zh0, *zh1;
 	bool recycled = 0;
 
 	/* if any pages on the zbpg list, use one */
@@ -235,34 +267,29 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 		zbpg = zcache_get_free_page();
 	if (likely(zbpg != NULL)) {
 		INIT_LIST_HEAD(&zbpg->bud_list);
-		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
 		spin_lock_init(&zbpg->lock);
 		if (recycled) {
 			ASSERT_INVERTED_SENTINEL(zbpg, ZBPG);
 			SET_SENTINEL(zbpg, ZBPG);
-			BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
-			BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
+			BUG_ON(zbpg->nr_buds != 0 || zbpg->nr_hdrs != 0);
 		} else {
 			atomic_inc(&zcache_zbud_curr_raw_pages);
 			INIT_LIST_HEAD(&zbpg->bud_list);
 			SET_SENTINEL(zbpg, ZBPG);
-			zh0->size = 0; zh1->size = 0;
-			tmem_oid_set_invalid(&zh0->oid);
-			tmem_oid_set_invalid(&zh1->oid);
+			zbpg->nr_hdrs = 0;
+			zbpg->nr_buds = 0;
 		}
+		zbpg->data_start = PAGE_SIZE;
 	}
 	return zbpg;
 }
 
 static void zbud_free_raw_page(struct zbud_page *zbpg)
 {
-	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
-
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
 	ASSERT_SPINLOCK(&zbpg->lock);
-	BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
-	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
+	BUG_ON(zbpg->nr_buds != 0 || zbpg->nr_hdrs != 0);
 	INVERT_SENTINEL(zbpg, ZBPG);
 	spin_unlock(&zbpg->lock);
 	spin_lock(&zbpg_unused_list_spinlock);
@@ -275,9 +302,31 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
  * core zbud handling routines
  */
 
+/* must hold zbpg->lock; the zbpg must have room for the data (and header) */
+static struct zbud_hdr *zbud_alloc_hdr(struct zbud_page *zbpg, unsigned size)
+{
+	struct zbud_hdr *zh;
+	unsigned i;
+
+	for (i = 0; i < zbpg->nr_hdrs; i++)
+		if (zbpg->buddy[i].size == 0)
+			break;
+	if (i == zbpg->nr_hdrs)
+		zbpg->nr_hdrs++;
+	zh = &zbpg->buddy[i];
+	zbpg->nr_buds++;
+	zbpg->data_start -= zbud_size_to_chunks(size) << CHUNK_SHIFT;
+	BUG_ON((char *)&zbpg->buddy[zbpg->nr_hdrs] >
+			(char *)zbpg + zbpg->data_start);
+	zh->offset = zbpg->data_start;
+	return zh;
+}
+
 static unsigned zbud_free(struct zbud_hdr *zh)
 {
-	unsigned size;
+	struct zbud_page *zbpg = zbud_page(zh);
+	unsigned size, len, i;
+	char *data;
 
 	ASSERT_SENTINEL(zh, ZBH);
 	BUG_ON(!tmem_oid_valid(&zh->oid));
@@ -286,6 +335,21 @@ static unsigned zbud_free(struct zbud_hdr *zh)
 	zh->size = 0;
 	tmem_oid_set_invalid(&zh->oid);
 	INVERT_SENTINEL(zh, ZBH);
+
+	/* slide the data below this zbud up to close the hole */
+	len = zbud_size_to_chunks(size) << CHUNK_SHIFT;
+	data = (char *)zbpg + zbpg->data_start;
+	memmove(data + len, data, zh->offset - zbpg->data_start);
+	for (i = 0; i < zbpg->nr_hdrs; i++)
+		if (zbpg->buddy[i].size && zbpg->buddy[i].offset < zh->offset)
+			zbpg->buddy[i].offset += len;
+	zbpg->data_start += len;
+
+	/* give unused headers at the end of the array back to the data */
+	zbpg->nr_buds--;
+	while (zbpg->nr_hdrs && zbpg->buddy[zbpg->nr_hdrs - 1].size == 0)
+		zbpg->nr_hdrs--;
+
 	zcache_zbud_curr_zbytes -= size;
 	atomic_dec(&zcache_zbud_curr_zpages);
 	return size;
@@ -293,11 +357,7 @@ static unsigned zbud_free(struct zbud_hdr *zh)
 
 static void zbud_free_and_delist(struct zbud_hdr *zh)
 {
-	unsigned chunks;
-	struct zbud_hdr *zh_other;
-	unsigned budnum = zbud_budnum(zh), size;
-	struct zbud_page *zbpg =
-		container_of(zh, struct zbud_page, buddy[budnum]);
+	struct zbud_page *zbpg = zbud_page(zh);
 
 	spin_lock(&zbpg->lock);
 	if (list_empty(&zbpg->bud_list)) {
@@ -305,24 +365,14 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 		spin_unlock(&zbpg->lock);
 		return;
 	}
-	size = zbud_free(zh);
-	ASSERT_SPINLOCK(&zbpg->lock);
-	zh_other = &zbpg->buddy[(budnum == 0) ? 1 : 0];
-	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
-		chunks = zbud_size_to_chunks(size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
-		list_del_init(&zbpg->bud_list);
-		zbud_unbuddied[chunks].count--;
+	spin_lock(&zbud_budlists_spinlock);
+	zbud_list_del(zbpg);
+	zbud_free(zh);
+	if (zbpg->nr_buds == 0) { /* was the last zbud: free the page */
 		spin_unlock(&zbud_budlists_spinlock);
 		zbud_free_raw_page(zbpg);
-	} else { /* was buddied: move remaining buddy to unbuddied list */
-		chunks = zbud_size_to_chunks(zh_other->size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
-		zbud_unbuddied[chunks].count++;
+	} else { /* move to the list matching the space now free */
+		zbud_list_add(zbpg);
 		spin_unlock(&zbud_budlists_spinlock);
 		spin_unlock(&zbpg->lock);
 	}
@@ -333,11 +383,11 @@ static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
 					uint32_t index, struct page *page,
 					void *cdata, unsigned size)
 {
-	struct zbud_hdr *zh0, *zh1, *zh = NULL;
+	struct zbud_hdr *zh = NULL;
 	struct zbud_page *zbpg = NULL, *ztmp;
 	unsigned nchunks;
 	char *to;
-	int i, found_good_buddy = 0;
+	int i;
 
 	nchunks = zbud_size_to_chunks(size) ;
 	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
@@ -345,10 +395,8 @@ static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
 		if (!list_empty(&zbud_unbuddied[i].list)) {
 			list_for_each_entry_safe(zbpg, ztmp,
 				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
+				if (spin_trylock(&zbpg->lock))
 					goto found_unbuddied;
-				}
 			}
 		}
 		spin_unlock(&zbud_budlists_spinlock);
@@ -357,38 +405,24 @@ static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
 	zbpg = zbud_alloc_raw_page();
 	if (unlikely(zbpg == NULL))
 		goto out;
-	/* ok, have a page, now compress the data before taking locks */
 	spin_lock(&zbpg->lock);
 	spin_lock(&zbud_budlists_spinlock);
-	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
-	zbud_unbuddied[nchunks].count++;
-	zh = &zbpg->buddy[0];
 	goto init_zh;
 
 found_unbuddied:
 	ASSERT_SPINLOCK(&zbpg->lock);
-	zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
-	BUG_ON(!((zh0->size == 0) ^ (zh1->size == 0)));
-	if (zh0->size != 0) { /* buddy0 in use, buddy1 is vacant */
-		ASSERT_SENTINEL(zh0, ZBH);
-		zh = zh1;
-	} else if (zh1->size != 0) { /* buddy1 in use, buddy0 is vacant */
-		ASSERT_SENTINEL(zh1, ZBH);
-		zh = zh0;
-	} else
-		BUG();
-	list_del_init(&zbpg->bud_list);
-	zbud_unbuddied[found_good_buddy].count--;
-	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
-	zcache_zbud_buddied_count++;
+	BUG_ON(zbud_free_chunks(zbpg) < nchunks);
+	zbud_list_del(zbpg);
 
 init_zh:
+	zh = zbud_alloc_hdr(zbpg, size);
 	SET_SENTINEL(zh, ZBH);
 	zh->size = size;
 	zh->index = index;
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
 	zh->client_id = client_id;
+	zbud_list_add(zbpg);
 	/* can wait to copy the data until the list locks are dropped */
 	spin_unlock(&zbud_budlists_spinlock);
 
@@ -406,14 +440,11 @@ out:
 
 static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 {
-	struct zbud_page *zbpg;
-	unsigned budnum = zbud_budnum(zh);
-	size_t out_len = PAGE_SIZE;
+	struct zbud_page *zbpg = zbud_page(zh);
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
 
-	zbpg = container_of(zh, struct zbud_page, buddy[budnum]);
 	spin_lock(&zbpg->lock);
 	if (list_empty(&zbpg->bud_list)) {
 		/* ignore zombie page... see zbud_evict_pages() */
@@ -425,9 +456,8 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	to_va = kmap_atomic(page, KM_USER0);
 	size = zh->size;
 	from_va = zbud_data(zh, size);
-	ret = lzo1x_decompress_safe(from_va, size, to_va, &out_len);
-	BUG_ON(ret != LZO_E_OK);
-	BUG_ON(out_len != PAGE_SIZE);
+	ret = zcache_decompress(from_va, size, to_va);
+	BUG_ON(ret);
 	kunmap_atomic(to_va, KM_USER0);
 out:
 	spin_unlock(&zbpg->lock);
@@ -448,40 +478,38 @@ static struct tmem_pool *zcache_get_pool_by_id(uint16_t cli_id,
 static void zcache_put_pool(struct tmem_pool *pool);
 
 /*
- * Flush and free all zbuds in a zbpg, then free the pageframe
+ * Flush and free all zbuds in a zbpg, then free the pageframe.  The zbpg
+ * is off all lists, so nobody else frees its zbuds and the lock can be
+ * dropped while each one is flushed from tmem.
  */
 static void zbud_evict_zbpg(struct zbud_page *zbpg)
 {
 	struct zbud_hdr *zh;
-	int i, j;
-	uint32_t pool_id[ZBUD_MAX_BUDS], client_id[ZBUD_MAX_BUDS];
-	uint32_t index[ZBUD_MAX_BUDS];
-	struct tmem_oid oid[ZBUD_MAX_BUDS];
+	int i;
+	uint32_t pool_id, client_id, index;
+	struct tmem_oid oid;
 	struct tmem_pool *pool;
 
 	ASSERT_SPINLOCK(&zbpg->lock);
 	BUG_ON(!list_empty(&zbpg->bud_list));
-	for (i = 0, j = 0; i < ZBUD_MAX_BUDS; i++) {
+	for (i = zbpg->nr_hdrs - 1; i >= 0; i--) {
 		zh = &zbpg->buddy[i];
-		if (zh->size) {
-			client_id[j] = zh->client_id;
-			pool_id[j] = zh->pool_id;
-			oid[j] = zh->oid;
-			index[j] = zh->index;
-			j++;
-			zbud_free(zh);
-		}
-	}
-	spin_unlock(&zbpg->lock);
-	for (i = 0; i < j; i++) {
-		pool = zcache_get_pool_by_id(client_id[i], pool_id[i]);
+		if (!zh->size)
+			continue;
+		client_id = zh->client_id;
+		pool_id = zh->pool_id;
+		oid = zh->oid;
+		index = zh->index;
+		zbud_free(zh);
+		spin_unlock(&zbpg->lock);
+		pool = zcache_get_pool_by_id(client_id, pool_id);
 		if (pool != NULL) {
-			tmem_flush_page(pool, &oid[i], index[i]);
+			tmem_flush_page(pool, &oid, index);
 			zcache_put_pool(pool);
 		}
+		spin_lock(&zbpg->lock);
 	}
 	ASSERT_SENTINEL(zbpg, ZBPG);
-	spin_lock(&zbpg->lock);
 	zbud_free_raw_page(zbpg);
 }
 
@@ -518,7 +546,7 @@ retry_unused_list:
 	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
 	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
+	for (i = 0; i < NCHUNKS; i++) {
 retry_unbud_list_i:
 		spin_lock_bh(&zbud_budlists_spinlock);
 		if (list_empty(&zbud_unbuddied[i].list)) {
@@ -596,6 +624,26 @@ static int zbud_show_unbuddied_list_counts(char *buf)
 	return p - buf;
 }
 
+/*
+ * Density actually achieved: compressed pages per raw page (including
+ * raw pages held on the unused list) and the share of those raw pages'
+ * bytes holding compressed data.
+ */
+static int zbud_show_density(char *buf)
+{
+	unsigned long raw_pages = atomic_read(&zcache_zbud_curr_raw_pages);
+	unsigned long zpages = atomic_read(&zcache_zbud_curr_zpages);
+	unsigned long density = 0, fill = 0;
+
+	if (raw_pages) {
+		density = zpages * 100 / raw_pages;
+		fill = div_u64((u64)zcache_zbud_curr_zbytes * 100,
+				raw_pages * PAGE_SIZE);
+	}
+	return sprintf(buf, "density:%lu.%02lu fill:%lu%%\n",
+			density / 100, density % 100, fill);
+}
+
 static int zbud_show_cumul_chunk_counts(char *buf)
 {
 	unsigned long i, chunks = 0, total_chunks = 0, sum_total_chunks = 0;
@@ -615,16 +663,17 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 		if (i == 42)
 			total_chunks_lte_42 = total_chunks;
 	}
-	p += sprintf(p, "<=21:%lu <=32:%lu <=42:%lu, mean:%lu\n",
+	p += sprintf(p, "<=21:%lu <=32:%lu <=42:%lu, mean:%lu, ",
 		total_chunks_lte_21, total_chunks_lte_32, total_chunks_lte_42,
 		chunks == 0 ? 0 : sum_total_chunks / chunks);
+	p += zbud_show_density(p);
 	return p - buf;
 }
 #endif
 
 /**********
  * This "zv" PAM implementation combines the TLSF-based xvMalloc
- * with lzo1x compression to maximize the amount of data that can
+ * with compression to maximize the amount of data that can
  * be packed into a physical page.
  *
  * Zv represents a PAM page with the index and object (plus a "size" value
@@ -711,7 +760,6 @@ static void zv_free(struct xv_pool *xvpool, struct zv_hdr *zv)
 
 static void zv_decompress(struct page *page, struct zv_hdr *zv)
 {
-	size_t clen = PAGE_SIZE;
 	char *to_va;
 	unsigned size;
 	int ret;
@@ -720,11 +768,9 @@ static void zv_decompress(struct page *page, struct zv_hdr *zv)
 	size = xv_get_object_size(zv) - sizeof(*zv);
 	BUG_ON(size == 0);
 	to_va = kmap_atomic(page, KM_USER0);
-	ret = lzo1x_decompress_safe((char *)zv + sizeof(*zv),
-					size, to_va, &clen);
+	ret = zcache_decompress((char *)zv + sizeof(*zv), size, to_va);
 	kunmap_atomic(to_va, KM_USER0);
-	BUG_ON(ret != LZO_E_OK);
-	BUG_ON(clen != PAGE_SIZE);
+	BUG_ON(ret);
 }
 
 #ifdef CONFIG_SYSFS
@@ -1301,55 +1347,80 @@ static struct tmem_pamops zcache_pamops = {
  * zcache compression/decompression and related per-cpu stuff
  */
 
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGE_ORDER 1
-static DEFINE_PER_CPU(unsigned char *, zcache_workmem);
+/*
+ * Any compressor registered with the crypto API can be used, selected
+ * with the "zcache=<name>" boot parameter.  Each cpu gets a transform of
+ * its own, as (de)compression always runs with interrupts disabled.
+ */
+static char zcache_comp_name[CRYPTO_MAX_ALG_NAME] = "lzo";
+
+#define ZCACHE_DSTMEM_PAGE_ORDER 1
+static DEFINE_PER_CPU(struct crypto_comp *, zcache_comp_tfm);
 static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
 
 static int zcache_compress(struct page *from, void **out_va, size_t *out_len)
 {
 	int ret = 0;
+	unsigned int dlen = PAGE_SIZE << ZCACHE_DSTMEM_PAGE_ORDER;
 	unsigned char *dmem = __get_cpu_var(zcache_dstmem);
-	unsigned char *wmem = __get_cpu_var(zcache_workmem);
+	struct crypto_comp *tfm = __get_cpu_var(zcache_comp_tfm);
 	char *from_va;
 
 	BUG_ON(!irqs_disabled());
-	if (unlikely(dmem == NULL || wmem == NULL))
-		goto out;  /* no buffer, so can't compress */
+	if (unlikely(dmem == NULL || tfm == NULL))
+		goto out;  /* no buffer or transform, so can't compress */
 	from_va = kmap_atomic(from, KM_USER0);
 	mb();
-	ret = lzo1x_1_compress(from_va, PAGE_SIZE, dmem, out_len, wmem);
-	BUG_ON(ret != LZO_E_OK);
-	*out_va = dmem;
+	if (!crypto_comp_compress(tfm, (u8 *)from_va, PAGE_SIZE,
+				  dmem, &dlen)) {
+		*out_va = dmem;
+		*out_len = dlen;
+		ret = 1;
+	}
 	kunmap_atomic(from_va, KM_USER0);
-	ret = 1;
 out:
 	return ret;
 }
 
+static int zcache_decompress(char *from_va, unsigned size, char *to_va)
+{
+	unsigned int dlen = PAGE_SIZE;
+	struct crypto_comp *tfm;
+	int ret;
+
+	tfm = get_cpu_var(zcache_comp_tfm);
+	ret = crypto_comp_decompress(tfm, (u8 *)from_va, size, (u8 *)to_va,
+				     &dlen);
+	put_cpu_var(zcache_comp_tfm);
+	if (ret == 0 && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
 
 static int zcache_cpu_notifier(struct notifier_block *nb,
 				unsigned long action, void *pcpu)
 {
 	int cpu = (long)pcpu;
 	struct zcache_preload *kp;
+	struct crypto_comp *tfm;
 
 	switch (action) {
 	case CPU_UP_PREPARE:
+		tfm = crypto_alloc_comp(zcache_comp_name, 0, 0);
+		if (IS_ERR(tfm))
+			return NOTIFY_BAD;
+		per_cpu(zcache_comp_tfm, cpu) = tfm;
 		per_cpu(zcache_dstmem, cpu) = (void *)__get_free_pages(
 			GFP_KERNEL | __GFP_REPEAT,
-			LZO_DSTMEM_PAGE_ORDER),
-		per_cpu(zcache_workmem, cpu) =
-			kzalloc(LZO1X_MEM_COMPRESS,
-				GFP_KERNEL | __GFP_REPEAT);
+			ZCACHE_DSTMEM_PAGE_ORDER);
 		break;
 	case CPU_DEAD:
 	case CPU_UP_CANCELED:
+		crypto_free_comp(per_cpu(zcache_comp_tfm, cpu));
+		per_cpu(zcache_comp_tfm, cpu) = NULL;
 		free_pages((unsigned long)per_cpu(zcache_dstmem, cpu),
-				LZO_DSTMEM_PAGE_ORDER);
+				ZCACHE_DSTMEM_PAGE_ORDER);
 		per_cpu(zcache_dstmem, cpu) = NULL;
-		kfree(per_cpu(zcache_workmem, cpu));
-		per_cpu(zcache_workmem, cpu) = NULL;
 		kp = &per_cpu(zcache_preloads, cpu);
 		while (kp->nr) {
 			kmem_cache_free(zcache_objnode_cache,
@@ -1371,6 +1442,11 @@ static struct notifier_block zcache_cpu_notifier_block = {
 };
 
 #ifdef CONFIG_SYSFS
+static int zcache_show_comp_algorithm(char *buf)
+{
+	return sprintf(buf, "%s\n", zcache_comp_name);
+}
+
 #define ZCACHE_SYSFS_RO(_name) \
 	static ssize_t zcache_##_name##_show(struct kobject *kobj, \
 				struct kobj_attribute *attr, char *buf) \
@@ -1431,6 +1507,7 @@ ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
 ZCACHE_SYSFS_RO_ATOMIC(curr_objnode_count);
+ZCACHE_SYSFS_RO_CUSTOM(comp_algorithm, zcache_show_comp_algorithm);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
@@ -1441,6 +1518,7 @@ ZCACHE_SYSFS_RO_CUSTOM(zv_cumul_dist_counts,
 			zv_cumul_dist_counts_show);
 
 static struct attribute *zcache_attrs[] = {
+	&zcache_comp_algorithm_attr.attr,
 	&zcache_curr_obj_count_attr.attr,
 	&zcache_curr_obj_count_max_attr.attr,
 	&zcache_curr_objnode_count_attr.attr,
@@ -1883,8 +1961,8 @@ static void zcache_frontswap_init(unsigned ignored)
 static struct frontswap_ops zcache_frontswap_ops = {
 	.put_page = zcache_frontswap_put_page,
 	.get_page = zcache_frontswap_get_page,
-	.flush_page = zcache_frontswap_flush_page,
-	.flush_area = zcache_frontswap_flush_area,
+	.invalidate_page = zcache_frontswap_flush_page,
+	.invalidate_area = zcache_frontswap_flush_area,
 	.init = zcache_frontswap_init
 };
 
@@ -1905,8 +1983,11 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
 
 static int zcache_enabled;
 
+/* "zcache" or "zcache=<compressor>" */
 static int __init enable_zcache(char *s)
 {
+	if (*s == '=')
+		strlcpy(zcache_comp_name, s + 1, sizeof(zcache_comp_name));
 	zcache_enabled = 1;
 	return 1;
 }
@@ -1949,6 +2030,11 @@ static int __init zcache_init(void)
 	if (zcache_enabled) {
 		unsigned int cpu;
 
+		if (!crypto_has_comp(zcache_comp_name, 0, 0)) {
+			pr_info("zcache: %s compressor not available, "
+				"using lzo\n", zcache_comp_name);
+			strcpy(zcache_comp_name, "lzo");
+		}
 		tmem_register_hostops(&zcache_hostops);
 		tmem_register_pamops(&zcache_pamops);
 		ret = register_cpu_notifier(&zcache_cpu_notifier_block);
@@ -1958,9 +2044,15 @@ static int __init zcache_init(void)
 		}
 		for_each_online_cpu(cpu) {
 			void *pcpu = (void *)(long)cpu;
-			zcache_cpu_notifier(&zcache_cpu_notifier_block,
-				CPU_UP_PREPARE, pcpu);
+			if (zcache_cpu_notifier(&zcache_cpu_notifier_block,
+					CPU_UP_PREPARE, pcpu) != NOTIFY_OK) {
+				pr_err("zcache: can't allocate %s compressor\n",
+					zcache_comp_name);
+				ret = -ENOMEM;
+				goto out;
+			}
 		}
+		pr_info("zcache: using %s compressor\n", zcache_comp_name);
 	}
 	zcache_objnode_cache = kmem_cache_create("zcache_objnode",
 				sizeof(struct tmem_objnode), 0, 0, NULL);
@@ -31,56 +31,16 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/jhash.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
 #ifdef CONFIG_ZRAM_FOR_ANDROID
 #include <linux/swap.h>
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 
 #include "zram_drv.h"
 
-#if defined(CONFIG_ZRAM_LZO)
-#include <linux/lzo.h>
-#define WMSIZE		LZO1X_MEM_COMPRESS
-#define COMPRESS(s, sl, d, dl, wm)	\
-	lzo1x_1_compress(s, sl, d, dl, wm)
-#define DECOMPRESS(s, sl, d, dl)	\
-	lzo1x_decompress_safe(s, sl, d, dl)
-#elif defined(CONFIG_ZRAM_SNAPPY)
-#include "../snappy/csnappy.h" /* if built in drivers/staging */
-#define WMSIZE_ORDER	((PAGE_SHIFT > 14) ? (15) : (PAGE_SHIFT+1))
-#define WMSIZE		(1 << WMSIZE_ORDER)
-static int
-snappy_compress_(
-	const unsigned char *src,
-	size_t src_len,
-	unsigned char *dst,
-	size_t *dst_len,
-	void *workmem)
-{
-	const unsigned char *end = csnappy_compress_fragment(
-		src, (uint32_t)src_len, dst, workmem, WMSIZE_ORDER);
-	*dst_len = end - dst;
-	return 0;
-}
-static int
-snappy_decompress_(
-	const unsigned char *src,
-	size_t src_len,
-	unsigned char *dst,
-	size_t *dst_len)
-{
-	uint32_t dst_len_ = (uint32_t)*dst_len;
-	int ret = csnappy_decompress_noheader(src, src_len, dst, &dst_len_);
-	*dst_len = (size_t)dst_len_;
-	return ret;
-}
-#define COMPRESS(s, sl, d, dl, wm)	\
-	snappy_compress_(s, sl, d, dl, wm)
-#define DECOMPRESS(s, sl, d, dl)	\
-	snappy_decompress_(s, sl, d, dl)
-#else
-#error either CONFIG_ZRAM_LZO or CONFIG_ZRAM_SNAPPY must be defined
-#endif
-
 /* Globals */
 static int zram_major;
 struct zram *zram_devices;
@@ -88,14 +48,14 @@ struct zram *zram_devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -117,6 +77,146 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+static struct zram_stream *zram_stream_alloc(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+	if (IS_ERR(zstrm->tfm)) {
+		pr_err("Error allocating %s compressor\n", zram->compressor);
+		kfree(zstrm);
+		return NULL;
+	}
+
+	/* lzo can expand incompressible input past PAGE_SIZE */
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zstrm->buffer) {
+		crypto_free_comp(zstrm->tfm);
+		kfree(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+static void zram_stream_free(struct zram_stream *zstrm)
+{
+	free_pages((unsigned long)zstrm->buffer, 1);
+	crypto_free_comp(zstrm->tfm);
+	kfree(zstrm);
+}
+
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_stream *zstrm, *tmp;
+
+	list_for_each_entry_safe(zstrm, tmp, &zram->idle_streams, list) {
+		list_del(&zstrm->list);
+		zram_stream_free(zstrm);
+	}
+}
+
+static int zram_create_streams(struct zram *zram)
+{
+	int i;
+	struct zram_stream *zstrm;
+
+	for (i = 0; i < zram->max_comp_streams; i++) {
+		zstrm = zram_stream_alloc(zram);
+		if (!zstrm) {
+			zram_destroy_streams(zram);
+			return -ENOMEM;
+		}
+		list_add(&zstrm->list, &zram->idle_streams);
+	}
+
+	return 0;
+}
+
+/*
+ * Take an idle compression stream, sleeping until another writer
+ * returns one if all max_comp_streams are busy.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	spin_lock(&zram->stream_lock);
+	while (list_empty(&zram->idle_streams)) {
+		spin_unlock(&zram->stream_lock);
+		wait_event(zram->stream_wait,
+			   !list_empty(&zram->idle_streams));
+		spin_lock(&zram->stream_lock);
+	}
+	zstrm = list_first_entry(&zram->idle_streams,
+				 struct zram_stream, list);
+	list_del(&zstrm->list);
+	spin_unlock(&zram->stream_lock);
+
+	return zstrm;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *zstrm)
+{
+	spin_lock(&zram->stream_lock);
+	list_add(&zstrm->list, &zram->idle_streams);
+	spin_unlock(&zram->stream_lock);
+
+	if (waitqueue_active(&zram->stream_wait))
+		wake_up(&zram->stream_wait);
+}
+
+static void zram_lock_slot(struct zram *zram, u32 index)
+{
+	spin_lock(&zram->slot_lock[index % ZRAM_SLOT_LOCKS]);
+}
+
+static void zram_unlock_slot(struct zram *zram, u32 index)
+{
+	spin_unlock(&zram->slot_lock[index % ZRAM_SLOT_LOCKS]);
+}
+
+static int zram_compress(struct zram *zram, struct zram_stream *zstrm,
+			 const unsigned char *src, unsigned char *dst,
+			 size_t *dst_len)
+{
+	int ret;
+	ktime_t start;
+	unsigned int dlen = *dst_len;
+
+	start = ktime_get();
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE, dst, &dlen);
+	zram_stat64_add(zram, &zram->stats.compr_time,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+	zram_stat64_inc(zram, &zram->stats.num_compr);
+
+	*dst_len = dlen;
+	return ret;
+}
+
+static int zram_decompress(struct zram *zram, struct zram_stream *zstrm,
+			   const unsigned char *src, size_t src_len,
+			   unsigned char *dst)
+{
+	int ret;
+	ktime_t start;
+	unsigned int dlen = PAGE_SIZE;
+
+	start = ktime_get();
+	ret = crypto_comp_decompress(zstrm->tfm, src, src_len, dst, &dlen);
+	zram_stat64_add(zram, &zram->stats.decompr_time,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+	zram_stat64_inc(zram, &zram->stats.num_decompr);
+
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -178,15 +278,163 @@ static void setup_swap_header(struct zram *zram, union swap_header *s)
 }
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 
+static u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+/*
+ * Return a referenced entry whose object decompresses to exactly the
+ * contents of mem, or NULL. zstrm->buffer is used as scratch space.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+		struct zram_stream *zstrm, unsigned char *mem, u32 checksum)
+{
+	int ret;
+	unsigned char *cmem;
+	struct rb_node *node;
+	struct zram_entry *entry = NULL;
+
+	spin_lock(&zram->dedup_lock);
+	node = zram->dedup_root.rb_node;
+	while (node) {
+		struct zram_entry *e = rb_entry(node, struct zram_entry,
+						rb_node);
+
+		if (checksum == e->checksum) {
+			entry = e;
+			entry->refcount++;
+			break;
+		}
+		node = checksum < e->checksum ? node->rb_left : node->rb_right;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	if (!entry)
+		return NULL;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = zram_decompress(zram, zstrm, cmem, entry->len, zstrm->buffer);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	if (!ret && !memcmp(mem, zstrm->buffer, PAGE_SIZE))
+		return entry;
+
+	/* Hash collision: the original owner still holds a reference */
+	spin_lock(&zram->dedup_lock);
+	entry->refcount--;
+	spin_unlock(&zram->dedup_lock);
+	return NULL;
+}
+
+/*
+ * Index a newly stored object. Returns NULL (and the caller stores the
+ * plain handle) if the entry cannot be allocated or an object with the
+ * same checksum is already indexed.
+ */
+static struct zram_entry *zram_dedup_add(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum)
+{
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->len = len;
+	entry->checksum = checksum;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	rb_node = &zram->dedup_root.rb_node;
+	while (*rb_node) {
+		struct zram_entry *e;
+
+		parent = *rb_node;
+		e = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum == e->checksum) {
+			spin_unlock(&zram->dedup_lock);
+			kfree(entry);
+			return NULL;
+		}
+		rb_node = checksum < e->checksum ?
+			&parent->rb_left : &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	atomic_inc(&zram->stats.dedup_entries);
+	return entry;
+}
+
+/* Drop a reference, freeing the object with the last one */
+static void zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	unsigned int refcount;
+
+	spin_lock(&zram->dedup_lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		rb_erase(&entry->rb_node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	if (refcount) {
+		zram_stat_dec(&zram->stats.pages_dedup);
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, entry->len);
+		return;
+	}
+
+	zs_free(zram->mem_pool, entry->handle);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+	atomic_dec(&zram->stats.dedup_entries);
+	kfree(entry);
+}
+
+static unsigned long zram_get_handle(struct zram *zram, u32 index)
+{
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return zram->table[index].entry->handle;
+	return zram->table[index].handle;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static u32 zram_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return ts.tv_sec;
+}
+
+/* Called with the slot lock held */
+static void zram_touch_slot(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = zram_now();
+}
+
+static void zram_wb_free_block(struct zram *zram, unsigned long blk)
+{
+	clear_bit(blk, zram->bd_bitmap);
+}
+#else
+static inline void zram_touch_slot(struct zram *zram, u32 index) { }
+static inline void zram_wb_free_block(struct zram *zram,
+				      unsigned long blk) { }
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
+/* Called with the slot lock held */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* Tells an in-flight writeback that the slot has changed */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -198,30 +446,527 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_wb_free_block(zram, handle);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		atomic_dec(&zram->stats.pages_wb);
+		zram_stat_dec(&zram->stats.pages_stored);
+		goto clear;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram->table[index].size;
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		/* compr_size is dropped along with the last reference */
+		zram_dedup_put(zram, zram->table[index].entry);
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		zram_stat_dec(&zram->stats.pages_stored);
+		goto clear;
+	}
+
+	zs_free(zram->mem_pool, handle);
+
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+clear:
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Pages written per batch; runs of adjacent blocks go out as one bio */
+#define ZRAM_WB_BATCH		32
+
+/* Longest wait between two idle writeback passes, in seconds */
+#define ZRAM_WB_IDLE_PERIOD_MAX	(60 * 60)
+
+struct zram_wb_batch {
+	int nr;
+	u32 index[ZRAM_WB_BATCH];
+	unsigned long blk[ZRAM_WB_BATCH];
+	struct page *page[ZRAM_WB_BATCH];	/* data to write */
+	struct page *buf[ZRAM_WB_BATCH];	/* for decompressed pages */
+};
+
+/* Tracks a set of bios to the backing device */
+struct zram_bdev_io {
+	atomic_t pending;
+	int error;
+	struct completion done;
+};
+
+static void zram_bdev_io_init(struct zram_bdev_io *io)
+{
+	atomic_set(&io->pending, 1);
+	io->error = 0;
+	init_completion(&io->done);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	struct zram_bdev_io *io = bio->bi_private;
+
+	if (err)
+		io->error = err;
+	if (atomic_dec_and_test(&io->pending))
+		complete(&io->done);
+	bio_put(bio);
+}
+
+static struct bio *zram_bdev_bio(struct zram *zram, unsigned long blk,
+				 int nr_pages, struct zram_bdev_io *io)
+{
+	struct bio *bio = bio_alloc(GFP_NOIO, nr_pages);
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = io;
+	return bio;
+}
+
+static void zram_bdev_submit(struct zram_bdev_io *io, int rw, struct bio *bio)
+{
+	atomic_inc(&io->pending);
+	submit_bio(rw, bio);
+}
+
+/* Drop the initial reference and wait for all submitted bios */
+static int zram_bdev_io_wait(struct zram_bdev_io *io)
+{
+	if (!atomic_dec_and_test(&io->pending))
+		wait_for_completion(&io->done);
+	return io->error;
+}
+
+struct zram_bdev_read_req {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long blk;
+	struct page *page;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_read_req *req;
+	struct zram_bdev_io io;
+	struct bio *bio;
+
+	req = container_of(work, struct zram_bdev_read_req, work);
+	zram_bdev_io_init(&io);
+	bio = zram_bdev_bio(req->zram, req->blk, 1, &io);
+	bio_add_page(bio, req->page, PAGE_SIZE, 0);
+	zram_bdev_submit(&io, READ_SYNC, bio);
+	req->ret = zram_bdev_io_wait(&io);
+}
+
+/*
+ * Read the page in slot index back from the backing device. Returns -EAGAIN
+ * if the slot no longer lives there, e.g. because it was rewritten.
+ *
+ * Bios submitted under zram_make_request() are only queued until it
+ * returns, so the read is issued and waited for by a worker instead.
+ */
+static int zram_bdev_read(struct zram *zram, u32 index, struct page *page)
+{
+	struct zram_bdev_read_req req;
+
+	down_read(&zram->wb_lock);
+	zram_lock_slot(zram, index);
+	if (!zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_unlock_slot(zram, index);
+		up_read(&zram->wb_lock);
+		return -EAGAIN;
+	}
+	req.blk = zram->table[index].handle;
+	zram_touch_slot(zram, index);
+	zram_unlock_slot(zram, index);
+
+	/* Even if the slot is freed now, wb_lock keeps the block unused */
+	req.zram = zram;
+	req.page = page;
+	INIT_WORK_ONSTACK(&req.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &req.work);
+	flush_work(&req.work);
+	destroy_work_on_stack(&req.work);
+	up_read(&zram->wb_lock);
+
+	if (unlikely(req.ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+			req.ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return req.ret;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	return 0;
+}
+
+/* As zram_bdev_read(), into a kernel buffer */
+static int zram_bdev_read_mem(struct zram *zram, u32 index, unsigned char *mem)
+{
+	int ret;
+	void *src;
+	struct page *page;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_bdev_read(zram, index, page);
+	if (!ret) {
+		src = kmap_atomic(page);
+		memcpy(mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	}
+
+	__free_page(page);
+	return ret;
+}
+
+/* Called with the slot lock held */
+static int zram_wb_candidate(struct zram *zram, u32 index,
+			     unsigned long mode, u32 now)
+{
+	struct table *t = &zram->table[index];
+
+	/* Objects shared through dedup stay in memory */
+	if (!t->handle || t->flags & (BIT(ZRAM_WB) | BIT(ZRAM_UNDER_WB) |
+				      BIT(ZRAM_DEDUP)))
+		return 0;
+
+	if (test_bit(ZRAM_WB_HUGE, &mode) &&
+	    zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		return 1;
+
+	return test_bit(ZRAM_WB_IDLE, &mode) && zram->wb_idle_age &&
+		now - t->ac_time >= zram->wb_idle_age;
+}
+
+/*
+ * Add a slot to the batch. Called with the slot lock held. Uncompressed
+ * pages are written from the slot's own page, which our reference keeps
+ * alive if the slot is freed meanwhile; compressed ones are decompressed
+ * into one of the batch buffers.
+ */
+static void zram_wb_prepare(struct zram *zram, struct zram_stream *zstrm,
+			    struct zram_wb_batch *wb, u32 index)
+{
+	int ret;
+	unsigned long handle;
+	unsigned char *cmem;
+	struct page *page;
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		page = zram->table[index].page;
+	} else {
+		page = wb->buf[wb->nr];
+		handle = zram->table[index].handle;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+		ret = zram_decompress(zram, zstrm, cmem,
+				      zram->table[index].size,
+				      page_address(page));
+		zs_unmap_object(zram->mem_pool, handle);
+		if (unlikely(ret))
+			return;
+	}
+
+	get_page(page);
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	wb->index[wb->nr] = index;
+	wb->page[wb->nr] = page;
+	wb->nr++;
 }
 
+/*
+ * Write out a batch and point the slots that did not change meanwhile at
+ * their blocks. Returns -ENOSPC once the backing device is full.
+ */
+static int zram_wb_write(struct zram *zram, struct zram_wb_batch *wb)
+{
+	int i, nr, ret;
+	u32 index;
+	unsigned long blk = 1;
+	struct bio *bio = NULL;
+	struct zram_bdev_io io;
+
+	down_write(&zram->wb_lock);
+	for (nr = 0; nr < wb->nr; nr++) {
+		blk = find_next_zero_bit(zram->bd_bitmap, zram->bd_blocks, blk);
+		if (blk >= zram->bd_blocks)
+			break;
+		set_bit(blk, zram->bd_bitmap);
+		wb->blk[nr] = blk++;
+	}
+	up_write(&zram->wb_lock);
+
+	zram_bdev_io_init(&io);
+	for (i = 0; i < nr; i++) {
+		if (bio && (wb->blk[i] != wb->blk[i - 1] + 1 ||
+			    !bio_add_page(bio, wb->page[i], PAGE_SIZE, 0))) {
+			zram_bdev_submit(&io, WRITE, bio);
+			bio = NULL;
+		}
+		if (!bio) {
+			bio = zram_bdev_bio(zram, wb->blk[i], nr - i, &io);
+			bio_add_page(bio, wb->page[i], PAGE_SIZE, 0);
+		}
+	}
+	if (bio)
+		zram_bdev_submit(&io, WRITE, bio);
+
+	ret = zram_bdev_io_wait(&io);
+	if (unlikely(ret))
+		pr_err("Backing device write failed! err=%d\n", ret);
+
+	for (i = 0; i < wb->nr; i++) {
+		index = wb->index[i];
+
+		zram_lock_slot(zram, index);
+		if (!ret && i < nr &&
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram->table[index].handle = wb->blk[i];
+			zram_set_flag(zram, index, ZRAM_WB);
+			atomic_inc(&zram->stats.pages_wb);
+			zram_stat_inc(&zram->stats.pages_stored);
+		} else {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			if (i < nr)
+				zram_wb_free_block(zram, wb->blk[i]);
+		}
+		zram_unlock_slot(zram, index);
+
+		put_page(wb->page[i]);
+	}
+
+	if (!ret) {
+		zram_stat64_add(zram, &zram->stats.bd_writes, nr);
+		if (nr < wb->nr)
+			ret = -ENOSPC;
+	}
+	wb->nr = 0;
+	return ret;
+}
+
+/* Called with init_lock held for read */
+static void zram_writeback(struct zram *zram, unsigned long mode)
+{
+	int i;
+	u32 index, now = zram_now();
+	size_t nr_pages = zram->disksize >> PAGE_SHIFT;
+	struct zram_stream *zstrm = NULL;
+	struct zram_wb_batch *wb;
+
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return;
+
+	/* Idle pages are mostly compressed and decompressed for writing */
+	if (test_bit(ZRAM_WB_IDLE, &mode)) {
+		for (i = 0; i < ZRAM_WB_BATCH; i++) {
+			wb->buf[i] = alloc_page(GFP_KERNEL);
+			if (!wb->buf[i])
+				goto out;
+		}
+	}
+
+	/*
+	 * Page 0 holds the swap header, which is read back at every swapon
+	 * and would only skew the backing device counters: leave it alone.
+	 */
+	for (index = 1; index < nr_pages; index++) {
+		cond_resched();
+retry:
+		zram_lock_slot(zram, index);
+		if (!zram_wb_candidate(zram, index, mode, now)) {
+			zram_unlock_slot(zram, index);
+			continue;
+		}
+
+		if (!zstrm && !zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+			/* Taking a stream may sleep */
+			zram_unlock_slot(zram, index);
+			zstrm = zram_stream_get(zram);
+			goto retry;
+		}
+
+		zram_wb_prepare(zram, zstrm, wb, index);
+		zram_unlock_slot(zram, index);
+
+		if (wb->nr < ZRAM_WB_BATCH)
+			continue;
+
+		if (zstrm) {
+			zram_stream_put(zram, zstrm);
+			zstrm = NULL;
+		}
+		if (zram_wb_write(zram, wb))
+			break;
+	}
+
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
+	if (wb->nr)
+		zram_wb_write(zram, wb);
+
+out:
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		if (wb->buf[i])
+			__free_page(wb->buf[i]);
+	}
+	kfree(wb);
+}
+
+static void zram_writeback_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work),
+					 struct zram, wb_work);
+	unsigned long mode;
+
+	/*
+	 * A reset holds init_lock while it waits for us to finish, so
+	 * don't block on it. The requested modes stay pending and the
+	 * pass is retried later; a reset cancels that and clears them.
+	 */
+	if (!down_read_trylock(&zram->init_lock)) {
+		queue_delayed_work(system_long_wq, &zram->wb_work, HZ);
+		return;
+	}
+
+	mode = xchg(&zram->wb_pending, 0);
+	if (zram->init_done && mode)
+		zram_writeback(zram, mode);
+	up_read(&zram->init_lock);
+}
+
+static void zram_writeback_idle_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work),
+					 struct zram, wb_idle_work);
+
+	zram_writeback_kick(zram, BIT(ZRAM_WB_IDLE), 0);
+	zram_writeback_arm_idle(zram);
+}
+
+/* Schedule a writeback pass over the pages selected by mode */
+void zram_writeback_kick(struct zram *zram, unsigned long mode,
+			 unsigned long delay)
+{
+	if (!zram->bdev)
+		return;
+
+	if (test_bit(ZRAM_WB_HUGE, &mode))
+		set_bit(ZRAM_WB_HUGE, &zram->wb_pending);
+	if (test_bit(ZRAM_WB_IDLE, &mode))
+		set_bit(ZRAM_WB_IDLE, &zram->wb_pending);
+	queue_delayed_work(system_long_wq, &zram->wb_work, delay);
+}
+
+void zram_writeback_arm_idle(struct zram *zram)
+{
+	unsigned int period = min_t(unsigned int, zram->wb_idle_age,
+				    ZRAM_WB_IDLE_PERIOD_MAX);
+
+	if (zram->bdev && period)
+		queue_delayed_work(system_long_wq, &zram->wb_idle_work,
+				   period * HZ);
+}
+
+static void zram_writeback_init(struct zram *zram)
+{
+	init_rwsem(&zram->wb_lock);
+	INIT_DELAYED_WORK(&zram->wb_work, zram_writeback_work);
+	INIT_DELAYED_WORK(&zram->wb_idle_work, zram_writeback_idle_work);
+}
+
+/* Stop writeback and release the backing device */
+static void zram_writeback_reset(struct zram *zram)
+{
+	cancel_delayed_work_sync(&zram->wb_idle_work);
+	cancel_delayed_work_sync(&zram->wb_work);
+	zram->wb_pending = 0;
+
+	if (zram->bdev)
+		blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+
+	vfree(zram->bd_bitmap);
+	zram->bd_bitmap = NULL;
+	zram->bd_blocks = 0;
+}
+
+/*
+ * Attach the block device at path as backing device, or detach the
+ * current one if path is NULL. Called with init_lock held for write,
+ * before the device is initialized.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	unsigned long nr_blocks, *bitmap;
+	struct block_device *bdev;
+
+	zram_writeback_reset(zram);
+	if (!path)
+		return 0;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		return -EINVAL;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		return -ENOMEM;
+	}
+	/* Block 0 is never used, so a zero handle still means an empty slot */
+	set_bit(0, bitmap);
+
+	zram->bdev = bdev;
+	zram->bd_bitmap = bitmap;
+	zram->bd_blocks = nr_blocks;
+	return 0;
+}
+#else
+static inline int zram_bdev_read(struct zram *zram, u32 index,
+				 struct page *page)
+{
+	return -EIO;
+}
+
+static inline int zram_bdev_read_mem(struct zram *zram, u32 index,
+				     unsigned char *mem)
+{
+	return -EIO;
+}
+
+static inline void zram_writeback_kick(struct zram *zram,
+				       unsigned long mode, unsigned long delay) { }
+static inline void zram_writeback_arm_idle(struct zram *zram) { }
+static inline void zram_writeback_init(struct zram *zram) { }
+static inline void zram_writeback_reset(struct zram *zram) { }
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
 static void handle_zero_page(struct bio_vec *bvec)
 {
 	struct page *page = bvec->bv_page;
@@ -255,106 +1000,146 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+static int zram_bvec_read_bdev(struct zram *zram, struct bio_vec *bvec,
+			       u32 index, int offset, unsigned char *uncmem)
+{
+	int ret;
+	unsigned char *user_mem;
+
+	if (!is_partial_io(bvec))
+		return zram_bdev_read(zram, index, bvec->bv_page);
+
+	ret = zram_bdev_read_mem(zram, index, uncmem);
+	if (ret)
+		return ret;
+
+	user_mem = kmap_atomic(bvec->bv_page);
+	memcpy(user_mem + bvec->bv_offset, uncmem + offset, bvec->bv_len);
+	kunmap_atomic(user_mem);
+
+	flush_dcache_page(bvec->bv_page);
+	return 0;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
-	int ret;
-	size_t clen;
+	int ret = 0;
 	struct page *page;
-	struct zobj_header *zheader;
+	unsigned long handle;
+	struct zram_stream *zstrm;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
+	if (is_partial_io(bvec)) {
+		/* Use  a temporary buffer to decompress the page */
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+		if (!uncmem) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+	}
+
+again:
+	zstrm = zram_stream_get(zram);
+	zram_lock_slot(zram, index);
+	zram_touch_slot(zram, index);
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
 		handle_zero_page(bvec);
-		return 0;
+		goto out;
 	}
 
 	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].page)) {
+	if (unlikely(!zram->table[index].handle)) {
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
 		handle_zero_page(bvec);
-		return 0;
+		goto out;
+	}
+
+	/* Page was written back: read it without holding the slot */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_unlock_slot(zram, index);
+		zram_stream_put(zram, zstrm);
+		ret = zram_bvec_read_bdev(zram, bvec, index, offset, uncmem);
+		if (ret == -EAGAIN)
+			goto again;
+		goto out_free;
 	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
-		return 0;
-	}
-
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
+		goto out;
 	}
 
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(zram->table[index].page) +
-		zram->table[index].offset;
+	handle = zram_get_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	ret = zram_decompress(zram, zstrm, cmem, zram->table[index].size,
+			uncmem);
+	zs_unmap_object(zram->mem_pool, handle);
 
-	ret = DECOMPRESS(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			uncmem, &clen);
-
-	if (is_partial_io(bvec)) {
+	if (is_partial_io(bvec))
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
 		       bvec->bv_len);
-		kfree(uncmem);
-	}
 
-	kunmap_atomic(cmem);
 	kunmap_atomic(user_mem);
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
+		goto out;
 	}
 
 	flush_dcache_page(page);
 
-	return 0;
+out:
+	zram_unlock_slot(zram, index);
+	zram_stream_put(zram, zstrm);
+out_free:
+	if (is_partial_io(bvec))
+		kfree(uncmem);
+	return ret;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+/* Called with the slot lock held */
+static int zram_read_before_write(struct zram *zram, struct zram_stream *zstrm,
+				  unsigned char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
+	unsigned long handle;
 	unsigned char *cmem;
 
 	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].page) {
+	    !zram->table[index].handle) {
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
-	cmem = kmap_atomic(zram->table[index].page) +
-		zram->table[index].offset;
+	/* Caller has to read it from the backing device, unlocked */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+		return -EAGAIN;
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].page);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
 		return 0;
 	}
 
-	ret = DECOMPRESS(cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			mem, &clen);
-	kunmap_atomic(cmem);
+	handle = zram_get_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	ret = zram_decompress(zram, zstrm, cmem, zram->table[index].size,
+			mem);
+	zs_unmap_object(zram->mem_pool, handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret)) {
@@ -366,44 +1151,52 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+/*
+ * Writes compress into a private stream without holding the slot lock and
+ * only take it to swap the new object into the table, so writers to
+ * different slots run fully in parallel.
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
 	size_t clen;
-	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	u32 checksum = 0;
+	unsigned long handle = 0;
+	struct zram_stream *zstrm;
+	struct zram_entry *entry = NULL;
+	struct page *page, *page_store = NULL;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
 		 * before to write the changes.
 		 */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
 			goto out;
 		}
-		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
-			goto out;
-		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].page ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	zstrm = zram_stream_get(zram);
+	src = zstrm->buffer;
+
+	if (is_partial_io(bvec)) {
+		do {
+			zram_lock_slot(zram, index);
+			ret = zram_read_before_write(zram, zstrm, uncmem, index);
+			zram_unlock_slot(zram, index);
+			if (ret == -EAGAIN)
+				ret = zram_bdev_read_mem(zram, index, uncmem);
+		} while (ret == -EAGAIN);
+		if (ret)
+			goto out_put;
+	}
 
 	user_mem = kmap_atomic(page);
 
@@ -415,89 +1208,134 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem);
+		zram_stream_put(zram, zstrm);
 		if (is_partial_io(bvec))
 			kfree(uncmem);
+
+		zram_lock_slot(zram, index);
+		if (zram->table[index].handle ||
+		    zram_test_flag(zram, index, ZRAM_ZERO))
+			zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
-		goto out;
+		zram_unlock_slot(zram, index);
+		return 0;
 	}
 
-	COMPRESS(uncmem, PAGE_SIZE, src, &clen,
-		zram->compress_workmem);
-	ret = 0;
-
-	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
-
-	if (unlikely(ret != 0)) {
-		pr_err("Compression failed! err=%d\n", ret);
-		goto out;
+	if (zram->use_dedup) {
+		checksum = zram_dedup_checksum(uncmem);
+		entry = zram_dedup_find(zram, zstrm, uncmem, checksum);
+		if (entry) {
+			kunmap_atomic(user_mem);
+			zram_stream_put(zram, zstrm);
+			if (is_partial_io(bvec))
+				kfree(uncmem);
+			clen = entry->len;
+			zram_stat_inc(&zram->stats.pages_dedup);
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+			goto install;
+		}
 	}
 
+	clen = 2 * PAGE_SIZE;
+	ret = zram_compress(zram, zstrm, uncmem, src, &clen);
+
 	/*
 	 * Page is incompressible. Store it as-is (uncompressed)
 	 * since we do not want to return too many disk write
 	 * errors which has side effect of hanging the system.
 	 */
-	if (unlikely(clen > max_zpage_size)) {
+	if (likely(!ret) && unlikely(clen > max_zpage_size)) {
 		clen = PAGE_SIZE;
+		if (!is_partial_io(bvec))
+			memcpy(src, uncmem, PAGE_SIZE);
+		else
+			src = uncmem;
+	}
+
+	kunmap_atomic(user_mem);
+
+	if (unlikely(ret != 0)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		goto out_put;
+	}
+
+	if (unlikely(clen == PAGE_SIZE)) {
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
 			pr_info("Error allocating memory for "
 				"incompressible page: %u\n", index);
 			ret = -ENOMEM;
-			goto out;
+			goto out_put;
 		}
-
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		zram->table[index].page = page_store;
-		src = kmap_atomic(page);
-		goto memstore;
+		handle = (unsigned long)page_store;
+		cmem = kmap_atomic(page_store);
+	} else {
+		handle = zs_malloc(zram->mem_pool, clen);
+		if (!handle) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%zu\n", index, clen);
+			ret = -ENOMEM;
+			goto out_put;
+		}
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
 	}
 
-	if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-		      &zram->table[index].page, &store_offset,
-		      GFP_NOIO | __GFP_HIGHMEM)) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
-	}
+	memcpy(cmem, src, clen);
 
-memstore:
-	zram->table[index].offset = store_offset;
+	if (unlikely(page_store))
+		kunmap_atomic(cmem);
+	else
+		zs_unmap_object(zram->mem_pool, handle);
 
-	cmem = kmap_atomic(zram->table[index].page) +
-		zram->table[index].offset;
+	zram_stream_put(zram, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (zram->use_dedup && !page_store)
+		entry = zram_dedup_add(zram, handle, clen, checksum);
 
-	memcpy(cmem, src, clen);
+install:
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_lock_slot(zram, index);
+	if (zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
 
-	kunmap_atomic(cmem);
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-		kunmap_atomic(src);
+	if (entry) {
+		zram->table[index].entry = entry;
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	} else {
+		zram->table[index].handle = handle;
+	}
+	zram->table[index].size = clen;
+	if (unlikely(page_store)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
+	zram_touch_slot(zram, index);
+	zram_unlock_slot(zram, index);
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
 
+	/* Give a burst of incompressible writes a second to batch up */
+	if (unlikely(page_store))
+		zram_writeback_kick(zram, BIT(ZRAM_WB_HUGE), HZ);
+
 	return 0;
 
+out_put:
+	zram_stream_put(zram, zstrm);
 out:
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -506,19 +1344,10 @@ out:
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
-	int ret;
+	if (rw == READ)
+		return zram_bvec_read(zram, bvec, index, offset, bio);
 
-	if (rw == READ) {
-		down_read(&zram->lock);
-		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
-		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
-
-	return ret;
+	return zram_bvec_write(zram, bvec, index, offset);
 }
 
 static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
@@ -637,34 +1466,33 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Wait for writeback; the backing device is reset with the rest */
+	zram_writeback_reset(zram);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	zram_destroy_streams(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		unsigned long handle = zram->table[index].handle;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(zram->table[index].page);
+		else if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, zram->table[index].entry);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	zram->dedup_root = RB_ROOT;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -699,18 +1527,9 @@ int zram_init_device(struct zram *zram)
 	if (!zram->disksize)
 		zram_set_disksize(zram, zram_default_disksize_bytes());
 
-	zram->compress_workmem = kzalloc(WMSIZE, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret) {
+		pr_err("Error allocating compression streams\n");
 		goto fail_no_table;
 	}
 
@@ -740,7 +1559,7 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -748,6 +1567,7 @@ int zram_init_device(struct zram *zram)
 	}
 
 	zram->init_done = 1;
+	zram_writeback_arm_idle(zram);
 	up_write(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
@@ -769,7 +1589,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_lock_slot(zram, index);
 	zram_free_page(zram, index);
+	zram_unlock_slot(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -780,11 +1602,21 @@ static const struct block_device_operations zram_devops = {
 
 static int create_device(struct zram *zram, int device_id)
 {
-	int ret = 0;
+	int i, ret = 0;
 
-	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	for (i = 0; i < ZRAM_SLOT_LOCKS; i++)
+		spin_lock_init(&zram->slot_lock[i]);
+	spin_lock_init(&zram->stream_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
+	INIT_LIST_HEAD(&zram->idle_streams);
+	init_waitqueue_head(&zram->stream_wait);
+	zram->max_comp_streams = num_online_cpus();
+	zram_writeback_init(zram);
+	strlcpy(zram->compressor, CONFIG_ZRAM_DEFAULT_COMPRESSOR,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -916,6 +1748,8 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		else
+			zram_writeback_reset(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -17,8 +17,14 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +32,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -50,9 +44,9 @@ static const unsigned default_disksize_perc_ram = 25;
 static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to the largest object
+ * zsmalloc can hold (PAGE_SIZE less its per-object handle word),
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -66,6 +60,9 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
 
+/* Number of spinlocks the table slots are hashed onto */
+#define ZRAM_SLOT_LOCKS		64
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
@@ -74,17 +71,51 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* table[].entry points to a (possibly shared) zram_entry */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device, table[].handle is its block */
+	ZRAM_WB,
+
+	/* Page is being copied to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/* Writeback modes (bits of zram->wb_pending) */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,	/* pages stored uncompressed */
+	ZRAM_WB_IDLE,	/* pages not accessed for wb_idle_age seconds */
+};
+
 /*-- Data structures */
 
+/*
+ * Index entry for an object that may be shared by several table slots
+ * holding identical pages. Only used when deduplication is enabled.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->dedup_root, by checksum */
+	u32 checksum;		/* of the uncompressed page */
+	unsigned int refcount;	/* no. of slots using the object */
+	unsigned long handle;
+	unsigned int len;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		unsigned long handle;	/* zsmalloc object or ZRAM_WB block */
+		struct page *page;	/* ZRAM_UNCOMPRESSED page */
+		struct zram_entry *entry; /* ZRAM_DEDUP object */
+	};
+	u16 size;	/* compressed object size */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds since boot */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -95,20 +126,46 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	atomic_t pages_zero;		/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	u64 num_compr;		/* no. of calls into the compressor */
+	u64 num_decompr;	/* no. of calls into the decompressor */
+	u64 compr_time;		/* total ns spent compressing */
+	u64 decompr_time;	/* total ns spent decompressing */
+	u64 dedup_saved;	/* compressed bytes not stored due to dedup */
+	atomic_t pages_dedup;	/* no. of pages sharing an existing object */
+	atomic_t dedup_entries;	/* no. of objects in the dedup index */
+	atomic_t pages_wb;	/* no. of pages on the backing device */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+};
+
+/*
+ * A compression transform plus its output buffer. Each in-flight read or
+ * write owns one, so up to max_comp_streams requests (de)compress in
+ * parallel.
+ */
+struct zram_stream {
+	struct crypto_comp *tfm;
+	void *buffer;		/* 2 pages: compressed output may expand */
+	struct list_head list;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
+	/* table[i] is protected by slot_lock[i % ZRAM_SLOT_LOCKS] */
+	spinlock_t slot_lock[ZRAM_SLOT_LOCKS];
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	spinlock_t stream_lock;	/* protects idle_streams */
+	struct list_head idle_streams;
+	wait_queue_head_t stream_wait;
+	int max_comp_streams;
+	spinlock_t dedup_lock;	/* protects dedup_root and entry refcounts */
+	struct rb_root dedup_root;
+	int use_dedup;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +176,19 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* crypto API name of the compression algorithm, set before init */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct block_device *bdev;	/* backing device, set before init */
+	unsigned long *bd_bitmap;	/* blocks in use on bdev */
+	unsigned long bd_blocks;	/* bdev size in pages */
+	/* Held for read across bdev reads and for write to allocate blocks */
+	struct rw_semaphore wb_lock;
+	unsigned long wb_pending;	/* requested zram_wb_mode bits */
+	unsigned int wb_idle_age;	/* seconds, 0 disables idle writeback */
+	struct delayed_work wb_work;
+	struct delayed_work wb_idle_work;
+#endif
 
 	struct zram_stats stats;
 };
@@ -131,5 +201,11 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_writeback_kick(struct zram *zram, unsigned long mode,
+				unsigned long delay);
+extern void zram_writeback_arm_idle(struct zram *zram);
+#endif
 
 #endif
@@ -0,0 +1,762 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects of similar size are grouped into size classes, ZS_SIZE_CLASS_DELTA
+ * bytes apart. Each class packs its objects back to back into "zspages" of
+ * one or more zero-order pages, the number of pages being chosen so that
+ * the tail waste is smallest. Since the pages of a zspage need not be
+ * contiguous, objects that straddle a page boundary are accessed through a
+ * per-cpu bounce buffer.
+ *
+ * Users only ever see handles. A handle points to a word holding the
+ * object's current location, so zs_compact() can move objects out of
+ * sparsely used zspages and free them without the user noticing.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/*
+ * Per-cpu state of the current zs_map_object() mapping. Only one object
+ * can be mapped on a CPU at a time.
+ */
+struct mapping_area {
+	char *vm_buf;		/* bounce buffer for straddling objects */
+	char *vm_addr;		/* kmap_atomic() address, or NULL */
+	struct page *pages[2];	/* pages of a straddling object */
+	int off;		/* offset of the object in pages[0] */
+	int size;
+	enum zs_mapmode vm_mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the zspage size (in pages) that wastes the least space at the
+ * tail for objects of the given size.
+ */
+static int get_pages_per_zspage(int size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static void pin_handle(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_handle(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_handle(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle >> HANDLE_PIN_BITS;
+}
+
+/* Store a new location, keeping the pin bit as it is */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *word = (unsigned long *)handle;
+
+	*word = (obj << HANDLE_PIN_BITS) | (*word & BIT(HANDLE_PIN_BIT));
+}
+
+static unsigned long obj_location(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+}
+
+static struct zspage *obj_to_zspage(unsigned long obj, unsigned int *idx)
+{
+	struct page *first_page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+
+	*idx = obj & OBJ_INDEX_MASK;
+	return (struct zspage *)page_private(first_page);
+}
+
+static unsigned long read_obj_head(struct size_class *class,
+				struct zspage *zspage, unsigned int idx)
+{
+	unsigned long off = idx * class->size;
+	unsigned long head;
+	void *addr;
+
+	/* Sizes are ZS_SIZE_CLASS_DELTA aligned: headers never straddle */
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT]);
+	head = *(unsigned long *)(addr + (off & ~PAGE_MASK));
+	kunmap_atomic(addr);
+
+	return head;
+}
+
+static void write_obj_head(struct size_class *class, struct zspage *zspage,
+				unsigned int idx, unsigned long head)
+{
+	unsigned long off = idx * class->size;
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT]);
+	*(unsigned long *)(addr + (off & ~PAGE_MASK)) = head;
+	kunmap_atomic(addr);
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+						struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse * ZS_FULLNESS_THRESHOLD_FRAC >=
+	    max_objects * (ZS_FULLNESS_THRESHOLD_FRAC - 1))
+		return ZS_ALMOST_FULL;
+	return ZS_ALMOST_EMPTY;
+}
+
+/*
+ * Move zspage to the fullness list matching its current usage.
+ * Called with the class lock held.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+						struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+	if (newfg < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < zspage->class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	atomic_long_sub(zspage->class->pages_per_zspage,
+			&pool->pages_allocated);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(pool->flags);
+
+		if (!page) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	/* Link all objects into the free list */
+	for (i = 0; i < class->objs_per_zspage; i++)
+		write_obj_head(class, zspage, i, (i + 1) << OBJ_TAG_BITS);
+	zspage->freeobj = 0;
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/* Called with the class lock held, zspage must not be full */
+static unsigned long obj_alloc(struct size_class *class,
+				struct zspage *zspage, unsigned long handle)
+{
+	unsigned int idx = zspage->freeobj;
+
+	zspage->freeobj = read_obj_head(class, zspage, idx) >> OBJ_TAG_BITS;
+	write_obj_head(class, zspage, idx, handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	return obj_location(zspage, idx);
+}
+
+/* Called with the class lock held */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int idx)
+{
+	write_obj_head(class, zspage, idx, zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, for debugging
+ * @flags: allocation flags used when growing the pool (__GFP_HIGHMEM is
+ *	allowed, the pool may sleep if the flags allow it)
+ *
+ * Returns the new pool, or NULL on allocation failure.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, j;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+	}
+
+	pool->name = name;
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+	atomic_long_set(&pool->objs_migrated, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg])) {
+				pr_info("Freeing non-empty class with size "
+					"%db, fullness group %d\n",
+					class->size, fg);
+			}
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * Returns a handle to the allocated object, or 0 on failure. The object
+ * must be mapped with zs_map_object() before it can be accessed.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cachep,
+					pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size + ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, (void *)handle);
+			return 0;
+		}
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj = obj_alloc(class, zspage, handle);
+	*(unsigned long *)handle = obj << HANDLE_PIN_BITS;
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	struct zspage *zspage;
+	struct size_class *class;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	pin_handle(handle);
+	zspage = obj_to_zspage(handle_to_obj(handle), &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+	unpin_handle(handle);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(pool, zspage);
+
+	kmem_cache_free(zs_handle_cachep, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * The object is pinned (cannot be freed or migrated) and preemption is
+ * disabled until zs_unmap_object() is called. Only one object can be
+ * mapped per CPU at a time and the caller must not sleep meanwhile.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned int idx;
+	unsigned long off;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct mapping_area *area;
+	int page_idx, size, first;
+
+	BUG_ON(!handle);
+
+	/* Also disables preemption, which keeps us on this CPU's area */
+	pin_handle(handle);
+	zspage = obj_to_zspage(handle_to_obj(handle), &idx);
+	class = zspage->class;
+
+	off = idx * class->size + ZS_HANDLE_SIZE;
+	size = class->size - ZS_HANDLE_SIZE;
+	page_idx = off >> PAGE_SHIFT;
+	off &= ~PAGE_MASK;
+
+	area = &__get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+
+	if (off + size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->vm_addr = kmap_atomic(zspage->pages[page_idx]);
+		return area->vm_addr + off;
+	}
+
+	/* this object spans two pages */
+	area->vm_addr = NULL;
+	area->pages[0] = zspage->pages[page_idx];
+	area->pages[1] = zspage->pages[page_idx + 1];
+	area->off = off;
+	area->size = size;
+
+	if (mm != ZS_MM_WO) {
+		void *addr;
+
+		first = PAGE_SIZE - off;
+		addr = kmap_atomic(area->pages[0]);
+		memcpy(area->vm_buf, addr + off, first);
+		kunmap_atomic(addr);
+		addr = kmap_atomic(area->pages[1]);
+		memcpy(area->vm_buf + first, addr, size - first);
+		kunmap_atomic(addr);
+	}
+
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area = &__get_cpu_var(zs_map_area);
+
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr);
+	} else if (area->vm_mm != ZS_MM_RO) {
+		void *addr;
+		int first = PAGE_SIZE - area->off;
+
+		addr = kmap_atomic(area->pages[0]);
+		memcpy(addr + area->off, area->vm_buf, first);
+		kunmap_atomic(addr);
+		addr = kmap_atomic(area->pages[1]);
+		memcpy(addr, area->vm_buf + first, area->size - first);
+		kunmap_atomic(addr);
+	}
+
+	unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Copy a whole object, header included, between (possibly) split slots */
+static void copy_object(struct size_class *class,
+			struct zspage *dst, unsigned int didx,
+			struct zspage *src, unsigned int sidx)
+{
+	unsigned long s_off = sidx * class->size;
+	unsigned long d_off = didx * class->size;
+	int size = class->size;
+
+	while (size) {
+		int s_po = s_off & ~PAGE_MASK;
+		int d_po = d_off & ~PAGE_MASK;
+		int len = min3(size, (int)PAGE_SIZE - s_po,
+				(int)PAGE_SIZE - d_po);
+		void *s_addr, *d_addr;
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT]);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT]);
+		memcpy(d_addr + d_po, s_addr + s_po, len);
+		kunmap_atomic(d_addr);
+		kunmap_atomic(s_addr);
+
+		size -= len;
+		s_off += len;
+		d_off += len;
+	}
+}
+
+/*
+ * Move as many objects as fit from src to dst. Objects that are pinned
+ * (mapped or being freed) are skipped. Returns the number of objects
+ * that could not be moved because they were pinned.
+ * Called with the class lock held.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *dst, struct zspage *src)
+{
+	unsigned int idx, didx;
+	unsigned long head, handle, obj;
+	int busy = 0;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		if (dst->inuse == class->objs_per_zspage)
+			break;
+
+		head = read_obj_head(class, src, idx);
+		if (!(head & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = head & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_handle(handle)) {
+			busy++;
+			continue;
+		}
+
+		obj = obj_alloc(class, dst, handle);
+		didx = obj & OBJ_INDEX_MASK;
+		copy_object(class, dst, didx, src, idx);
+		record_obj(handle, obj);
+		obj_free(class, src, idx);
+		unpin_handle(handle);
+
+		atomic_long_inc(&pool->objs_migrated);
+	}
+
+	return busy;
+}
+
+/* Least used almost-empty zspage, the cheapest to drain */
+static struct zspage *find_source_zspage(struct size_class *class)
+{
+	struct zspage *zspage, *src = NULL;
+
+	list_for_each_entry(zspage, &class->fullness_list[ZS_ALMOST_EMPTY],
+				list) {
+		if (!src || zspage->inuse < src->inuse)
+			src = zspage;
+	}
+
+	return src;
+}
+
+/* Most used partial zspage other than src, to fill it up */
+static struct zspage *find_dest_zspage(struct size_class *class,
+					struct zspage *src)
+{
+	int fg;
+	struct zspage *zspage, *dst = NULL;
+
+	for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+		list_for_each_entry(zspage, &class->fullness_list[fg], list) {
+			if (zspage != src &&
+			    (!dst || zspage->inuse > dst->inuse))
+				dst = zspage;
+		}
+		if (dst)
+			break;
+	}
+
+	return dst;
+}
+
+/* Would draining one more zspage of this class free it? */
+static int zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted = class->zspages * class->objs_per_zspage -
+					class->objs_inuse;
+
+	return obj_wasted >= class->objs_per_zspage;
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+					struct size_class *class)
+{
+	struct zspage *src, *dst, *tmp;
+	unsigned long freed = 0;
+	int busy;
+	LIST_HEAD(free_list);
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		src = find_source_zspage(class);
+		if (!src)
+			break;
+
+		while (src->inuse) {
+			dst = find_dest_zspage(class, src);
+			if (!dst)
+				break;
+			busy = migrate_zspage(pool, class, dst, src);
+			fix_fullness_group(class, dst);
+			if (busy)
+				break;
+		}
+
+		/* Some objects are in use; leave the rest of the class be */
+		if (fix_fullness_group(class, src) != ZS_EMPTY)
+			break;
+
+		class->zspages--;
+		list_add(&src->list, &free_list);
+		freed += class->pages_per_zspage;
+
+		/* Don't hog the lock, the remaining work is picked up anew */
+		if (need_resched() || spin_is_contended(&class->lock)) {
+			spin_unlock(&class->lock);
+			cond_resched();
+			spin_lock(&class->lock);
+		}
+	}
+	spin_unlock(&class->lock);
+
+	list_for_each_entry_safe(src, tmp, &free_list, list) {
+		list_del(&src->list);
+		free_zspage(pool, src);
+	}
+
+	return freed;
+}
+
+/**
+ * zs_compact - migrate objects to free sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * May sleep. Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class = &pool->size_class[i];
+
+		/* Classes with one object per zspage never fragment */
+		if (class->objs_per_zspage == 1)
+			continue;
+		freed += zs_compact_class(pool, class);
+		cond_resched();
+	}
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_get_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long allocated, used;
+
+		spin_lock(&class->lock);
+		allocated = class->zspages * class->objs_per_zspage;
+		used = class->objs_inuse;
+		spin_unlock(&class->lock);
+
+		stats->objs_allocated += allocated;
+		stats->objs_used += used;
+		stats->bytes_unused += (u64)(allocated - used) * class->size;
+	}
+
+	stats->pages_allocated = atomic_long_read(&pool->pages_allocated);
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
+	stats->objs_migrated = atomic_long_read(&pool->objs_migrated);
+}
+EXPORT_SYMBOL_GPL(zs_get_pool_stats);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+						0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf) {
+			zs_free_map_areas();
+			kmem_cache_destroy(zs_handle_cachep);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_free_map_areas();
+	kmem_cache_destroy(zs_handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Memory allocator for compressed pages");
@@ -0,0 +1,52 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+/*
+ * zs_map_object() access mode. Objects straddling a page boundary are
+ * copied through a per-cpu buffer; the mode avoids needless copies.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,	/* normal read-write mapping */
+	ZS_MM_RO,	/* read-only (no copy-out at unmap time) */
+	ZS_MM_WO	/* write-only (no copy-in at map time) */
+};
+
+struct zs_pool_stats {
+	unsigned long pages_allocated;	/* pages backing the pool */
+	unsigned long pages_compacted;	/* pages freed by zs_compact() */
+	unsigned long objs_migrated;	/* objects moved by zs_compact() */
+	unsigned long objs_allocated;	/* object slots in all zspages */
+	unsigned long objs_used;	/* slots holding live objects */
+	u64 bytes_unused;		/* bytes in slots not holding objects */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+unsigned long zs_compact(struct zs_pool *pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+void zs_get_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE zero-order pages
+ * holding objects of one size class back to back. Objects may straddle
+ * the boundary between two pages of a zspage.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Every object starts with a header word: while allocated it holds the
+ * object's handle tagged with OBJ_ALLOCATED_TAG (the back-reference
+ * compaction needs to move it), while free it holds the index of the
+ * next free object shifted by OBJ_TAG_BITS.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1
+#define OBJ_TAG_BITS		1
+
+/* Object sizes (including header) are multiples of ZS_SIZE_CLASS_DELTA */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A handle points to a word storing the object's location: the pfn of
+ * the first page of its zspage and the object index within the zspage.
+ * Bit 0 of that word is a bit spinlock pinning the object in place
+ * while it is mapped, freed or migrated.
+ */
+#define OBJ_INDEX_BITS		(PAGE_SHIFT - 3)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+#define HANDLE_PIN_BIT		0
+#define HANDLE_PIN_BITS		1
+
+/*
+ * Partially used zspages are kept on per-class lists by how full they
+ * are. Allocation prefers almost full zspages, compaction drains
+ * almost empty ones into them. Empty zspages are freed immediately and
+ * full ones are on no list.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+	ZS_FULL
+};
+
+/* A zspage is almost full at 3/4 of its objects in use */
+#define ZS_FULLNESS_THRESHOLD_FRAC	4
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list */
+	struct size_class *class;
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned int freeobj;		/* index of first free object */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size, header included */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	/* Stats, protected by lock */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	const char *name;
+	gfp_t flags;	/* allocation flags used when growing pool */
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+	atomic_long_t objs_migrated;
+};
+
+#endif
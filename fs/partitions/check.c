@@ -298,6 +298,96 @@ ssize_t part_inflight_show(struct device *dev,
 		atomic_read(&p->in_flight[1]));
 }
 
+#ifdef CONFIG_BLK_IO_LAT_HIST
+/* serializes switching the histograms on and off */
+static DEFINE_MUTEX(part_lat_hist_mutex);
+
+ssize_t part_lat_hist_show(struct device *dev,
+			   struct device_attribute *attr, char *buf)
+{
+	static const char * const stage[DISK_LAT_NR] = { "wait", "service" };
+	static const char * const type[2][2] = {
+		{ "async_read", "async_write" },
+		{ "sync_read", "sync_write" },
+	};
+	struct hd_struct *p = dev_to_part(dev);
+	struct disk_lat_hist __percpu *hist;
+	int s, sync, rw, b, cpu;
+	ssize_t len = 0;
+
+	mutex_lock(&part_lat_hist_mutex);
+	hist = rcu_dereference_protected(p->lat_hist,
+				lockdep_is_held(&part_lat_hist_mutex));
+	if (!hist) {
+		len = sprintf(buf, "disabled\n");
+		goto out;
+	}
+
+	for (s = 0; s < DISK_LAT_NR; s++)
+		for (sync = 1; sync >= 0; sync--)
+			for (rw = READ; rw <= WRITE; rw++) {
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						 "%s_%s", stage[s],
+						 type[sync][rw]);
+				for (b = 0; b < DISK_LAT_BUCKETS; b++) {
+					unsigned long n = 0;
+
+					for_each_possible_cpu(cpu)
+						n += per_cpu_ptr(hist, cpu)->
+							buckets[s][sync][rw][b];
+					len += scnprintf(buf + len,
+							 PAGE_SIZE - len,
+							 " %lu", n);
+				}
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						 "\n");
+			}
+out:
+	mutex_unlock(&part_lat_hist_mutex);
+	return len;
+}
+
+ssize_t part_lat_hist_store(struct device *dev,
+			    struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct hd_struct *p = dev_to_part(dev);
+	struct disk_lat_hist __percpu *hist;
+	int enable, cpu;
+
+	if (count == 0 || sscanf(buf, "%d", &enable) != 1)
+		return -EINVAL;
+
+	mutex_lock(&part_lat_hist_mutex);
+	hist = rcu_dereference_protected(p->lat_hist,
+				lockdep_is_held(&part_lat_hist_mutex));
+	if (enable && hist) {
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(hist, cpu), 0,
+			       sizeof(struct disk_lat_hist));
+	} else if (enable) {
+		hist = alloc_percpu(struct disk_lat_hist);
+		if (!hist) {
+			count = -ENOMEM;
+			goto out;
+		}
+		rcu_assign_pointer(p->lat_hist, hist);
+	} else if (hist) {
+		rcu_assign_pointer(p->lat_hist, NULL);
+		synchronize_rcu();
+		free_percpu(hist);
+	}
+out:
+	mutex_unlock(&part_lat_hist_mutex);
+	return count;
+}
+
+void free_part_lat_hist(struct hd_struct *part)
+{
+	free_percpu(rcu_dereference_protected(part->lat_hist, 1));
+}
+#endif
+
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 ssize_t part_fail_show(struct device *dev,
 		       struct device_attribute *attr, char *buf)
@@ -330,6 +420,10 @@ static DEVICE_ATTR(discard_alignment, S_IRUGO, part_discard_alignment_show,
 		   NULL);
 static DEVICE_ATTR(stat, S_IRUGO, part_stat_show, NULL);
 static DEVICE_ATTR(inflight, S_IRUGO, part_inflight_show, NULL);
+#ifdef CONFIG_BLK_IO_LAT_HIST
+static DEVICE_ATTR(latency_hist, S_IRUGO|S_IWUSR, part_lat_hist_show,
+		   part_lat_hist_store);
+#endif
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 static struct device_attribute dev_attr_fail =
 	__ATTR(make-it-fail, S_IRUGO|S_IWUSR, part_fail_show, part_fail_store);
@@ -344,6 +438,9 @@ static struct attribute *part_attrs[] = {
 	&dev_attr_discard_alignment.attr,
 	&dev_attr_stat.attr,
 	&dev_attr_inflight.attr,
+#ifdef CONFIG_BLK_IO_LAT_HIST
+	&dev_attr_latency_hist.attr,
+#endif
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 	&dev_attr_fail.attr,
 #endif
@@ -366,6 +463,7 @@ static void part_release(struct device *dev)
 {
 	struct hd_struct *p = dev_to_part(dev);
 	free_part_stats(p);
+	free_part_lat_hist(p);
 	free_part_info(p);
 	kfree(p);
 }
@@ -0,0 +1,129 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+/*
+ * Multi-queue block layer.
+ *
+ * A driver that registers with blk_mq_init_queue() gets no request_fn and
+ * no elevator. Bios are turned into requests by the submitting CPU and
+ * staged on that CPU's software queue (struct blk_mq_ctx), then handed to
+ * the driver's ->queue_rq() through one of its hardware contexts, which
+ * the software queues are mapped to by ->map_queue(). Requests are
+ * preallocated per hardware context, one per tag, so the tag a request
+ * arrives with is the driver's to use as a command slot, and up to
+ * cmd_size bytes of driver data follow each request (blk_mq_rq_to_pdu()).
+ *
+ * ->queue_rq() may be called concurrently for one hardware context on
+ * several CPUs. A driver that runs out of room stops the context with
+ * blk_mq_stop_hw_queue() and returns BLK_MQ_RQ_QUEUE_BUSY; the request,
+ * and those behind it, are dispatched again once the driver restarts the
+ * context with blk_mq_start_stopped_hw_queues(), typically on completion.
+ *
+ * Requests end with blk_mq_end_io(). A driver completing from interrupt
+ * context calls blk_mq_complete_request() instead, which runs ->complete()
+ * (or ends the request) on the CPU that submitted it, as long as
+ * rq_affinity is set for the queue, as it is by default.
+ *
+ * There is no request timeout handling, and flushes are not sequenced:
+ * a driver that advertises a volatile cache with blk_queue_flush() gets
+ * REQ_FLUSH and REQ_FUA requests as they come and must order them itself.
+ */
+
+struct blk_mq_hw_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	dispatch;	/* bounced by ->queue_rq */
+	} ____cacheline_aligned_in_smp;
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+	cpumask_var_t		cpumask;
+
+	unsigned long		flags;		/* BLK_MQ_F_* flags */
+
+	struct request_queue	*queue;
+	void			*driver_data;
+	unsigned int		queue_num;
+
+	/* the software queues mapped here, and which of them have work */
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;
+
+	/* tags, and the request preallocated for each of them */
+	unsigned int		queue_depth;
+	unsigned long		*tag_map;
+	wait_queue_head_t	tag_wait;
+	struct request		**rqs;
+	void			*rq_mem;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;
+	unsigned int		cmd_size;	/* per-request driver data */
+	int			numa_node;
+	unsigned int		flags;		/* BLK_MQ_F_* flags */
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *,
+					     const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/* queue a request to the hardware, returning BLK_MQ_RQ_QUEUE_* */
+	queue_rq_fn		*queue_rq;
+
+	/* the hardware context a cpu's software queue dispatches to */
+	map_queue_fn		*map_queue;
+
+	/* completion on the submitting cpu, defaults to blk_mq_end_io */
+	softirq_done_fn		*complete;
+
+	/* optional, called as each hardware context is set up and freed */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue IO for later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end IO with error */
+
+	BLK_MQ_F_SHOULD_MERGE	= 1 << 0,
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int);
+
+void blk_mq_end_io(struct request *rq, int error);
+void blk_mq_complete_request(struct request *rq);
+
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+void blk_mq_run_queues(struct request_queue *q, bool async);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_start_stopped_hw_queues(struct request_queue *q);
+
+/*
+ * Driver command data is immediately after the request. So subtract request
+ * size to get back to the original request.
+ */
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return pdu - sizeof(struct request);
+}
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+#endif
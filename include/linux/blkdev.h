@@ -31,6 +31,9 @@ struct blk_trace;
 struct request;
 struct sg_io_hdr;
 struct bsg_job;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -82,6 +85,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;	/* software queue, multi-queue only */
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -128,6 +132,11 @@ struct request {
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+#endif
+#ifdef CONFIG_BLK_IO_LAT_HIST
+	/* zero unless the latency histograms of the partition are on */
+	u64 lat_hist_start_ns;
+	u64 lat_hist_io_start_ns;
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -287,6 +296,8 @@ struct request_queue {
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	struct blk_mq_ops	*mq_ops;
+
 	/*
 	 * Dispatch queue sorting
 	 */
@@ -298,6 +309,14 @@ struct request_queue {
 	 */
 	struct delayed_work	delay_work;
 
+	/*
+	 * Multi-queue: the per-cpu software queues and the hardware
+	 * contexts they are mapped to, see include/linux/blk-mq.h
+	 */
+	struct blk_mq_ctx __percpu	*queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
 	struct backing_dev_info	backing_dev_info;
 
 	/*
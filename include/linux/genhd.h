@@ -96,6 +96,21 @@ struct partition_meta_info {
 	u8 volname[PARTITION_META_INFO_VOLNAMELTH];
 };
 
+#ifdef CONFIG_BLK_IO_LAT_HIST
+/* Bucket i counts latencies below 2^i usec, the last one all the others */
+#define DISK_LAT_BUCKETS	24
+
+enum {
+	DISK_LAT_WAIT,		/* insertion to dispatch to the driver */
+	DISK_LAT_SERVICE,	/* dispatch to completion */
+	DISK_LAT_NR,
+};
+
+struct disk_lat_hist {
+	unsigned long buckets[DISK_LAT_NR][2][2][DISK_LAT_BUCKETS]; /* [sync][rw] */
+};
+#endif
+
 struct hd_struct {
 	sector_t start_sect;
 	sector_t nr_sects;
@@ -114,6 +129,9 @@ struct hd_struct {
 	struct disk_stats __percpu *dkstats;
 #else
 	struct disk_stats dkstats;
+#endif
+#ifdef CONFIG_BLK_IO_LAT_HIST
+	struct disk_lat_hist __percpu *lat_hist;
 #endif
 	atomic_t ref;
 	struct rcu_head rcu_head;
@@ -620,6 +638,18 @@ extern ssize_t part_stat_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
 extern ssize_t part_inflight_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
+#ifdef CONFIG_BLK_IO_LAT_HIST
+extern ssize_t part_lat_hist_show(struct device *dev,
+				  struct device_attribute *attr, char *buf);
+extern ssize_t part_lat_hist_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count);
+extern void free_part_lat_hist(struct hd_struct *part);
+#else
+static inline void free_part_lat_hist(struct hd_struct *part)
+{
+}
+#endif /* CONFIG_BLK_IO_LAT_HIST */
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 extern ssize_t part_fail_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
@@ -114,6 +114,8 @@ enum zone_stat_item {
 	NUMA_LOCAL,		/* allocation from local node */
 	NUMA_OTHER,		/* allocation from other node */
 #endif
+	WORKINGSET_REFAULT,	/* evicted file pages faulted back in */
+	WORKINGSET_ACTIVATE,	/* refaults activated: reuse fit in memory */
 	NR_ANON_TRANSPARENT_HUGEPAGES,
 	NR_VM_ZONE_STAT_ITEMS };
 
@@ -281,6 +283,15 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+/*
+ * A set of LRU lists.  Every LRU page is on exactly one of them: the
+ * zone's own when the memory controller is disabled, otherwise the
+ * one of the memory cgroup the page is charged to.
+ */
+struct lruvec {
+	struct list_head lists[NR_LRU_LISTS];
+};
+
 struct zone {
 	/* Fields commonly accessed by the page allocator */
 
@@ -346,12 +357,13 @@ struct zone {
 
 	/* Fields commonly accessed by the page reclaim scanner */
 	spinlock_t		lru_lock;	
-	struct zone_lru {
-		struct list_head list;
-	} lru[NR_LRU_LISTS];
+	struct lruvec		lruvec;
 
 	struct zone_reclaim_stat reclaim_stat;
 
+	/* Evictions and activations, the clock of refault distances */
+	atomic_long_t		inactive_age;
+
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
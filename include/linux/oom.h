@@ -42,6 +42,32 @@ enum oom_constraint {
 
 extern int test_set_oom_score_adj(int new_val);
 
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+/* Called with tasklist_lock or the task's siglock held, irqs disabled */
+extern void lowmem_adj_add(struct task_struct *p);
+extern void lowmem_adj_del(struct task_struct *p);
+extern void lowmem_adj_replace(struct task_struct *old,
+			       struct task_struct *new);
+extern void lowmem_adj_update(struct task_struct *p);
+#else
+static inline void lowmem_adj_add(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_del(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_replace(struct task_struct *old,
+				      struct task_struct *new)
+{
+}
+
+static inline void lowmem_adj_update(struct task_struct *p)
+{
+}
+#endif
+
 extern unsigned int oom_badness(struct task_struct *p, struct mem_cgroup *mem,
 			const nodemask_t *nodemask, unsigned long totalpages);
 extern int try_set_zonelist_oom(struct zonelist *zonelist, gfp_t gfp_flags);
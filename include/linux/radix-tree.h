@@ -245,8 +245,8 @@ radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 		unsigned int tag);
 unsigned int
 radix_tree_gang_lookup_tag_slot(struct radix_tree_root *root, void ***results,
-		unsigned long first_index, unsigned int max_items,
-		unsigned int tag);
+		unsigned long *indices, unsigned long first_index,
+		unsigned int max_items, unsigned int tag);
 unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 		unsigned long *first_indexp, unsigned long last_index,
 		unsigned long nr_to_tag,
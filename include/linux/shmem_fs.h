@@ -47,6 +47,7 @@ extern int shmem_fill_super(struct super_block *sb, void *data, int silent);
 extern struct file *shmem_file_setup(const char *name,
 					loff_t size, unsigned long flags);
 extern int shmem_zero_setup(struct vm_area_struct *);
+extern bool shmem_mapping(struct address_space *mapping);
 extern int shmem_lock(struct file *file, int lock, struct user_struct *user);
 extern struct page *shmem_read_mapping_page_gfp(struct address_space *mapping,
 					pgoff_t index, gfp_t gfp_mask);
@@ -82,6 +82,48 @@ DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
 	    TP_ARGS(cpu_id, load, curtarg, curactual, newtarg)
 );
 
+TRACE_EVENT(cpufreq_interactive_cluster,
+	    TP_PROTO(unsigned long cpu_id, unsigned long ncpus,
+		     unsigned long load, unsigned long maxload,
+		     unsigned long sumload, unsigned long nrbusy,
+		     unsigned long clusterload, unsigned long curtarg,
+		     unsigned long curactual),
+	    TP_ARGS(cpu_id, ncpus, load, maxload, sumload, nrbusy,
+		    clusterload, curtarg, curactual),
+
+	    TP_STRUCT__entry(
+		    __field(unsigned long, cpu_id      )
+		    __field(unsigned long, ncpus       )
+		    __field(unsigned long, load        )
+		    __field(unsigned long, maxload     )
+		    __field(unsigned long, sumload     )
+		    __field(unsigned long, nrbusy      )
+		    __field(unsigned long, clusterload )
+		    __field(unsigned long, curtarg     )
+		    __field(unsigned long, curactual   )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->ncpus = ncpus;
+		    __entry->load = load;
+		    __entry->maxload = maxload;
+		    __entry->sumload = sumload;
+		    __entry->nrbusy = nrbusy;
+		    __entry->clusterload = clusterload;
+		    __entry->curtarg = curtarg;
+		    __entry->curactual = curactual;
+	    ),
+
+	    TP_printk("cpu=%lu ncpus=%lu load=%lu max=%lu sum=%lu "
+		      "busy=%lu.%02lu cluster=%lu cur=%lu actual=%lu",
+		      __entry->cpu_id, __entry->ncpus, __entry->load,
+		      __entry->maxload, __entry->sumload,
+		      __entry->nrbusy / 100, __entry->nrbusy % 100,
+		      __entry->clusterload, __entry->curtarg,
+		      __entry->curactual)
+);
+
 TRACE_EVENT(cpufreq_interactive_boost,
 	    TP_PROTO(const char *s),
 	    TP_ARGS(s),
@@ -5094,6 +5094,7 @@ int idle_cpu(int cpu)
 {
 	return cpu_curr(cpu) == cpu_rq(cpu)->idle;
 }
+EXPORT_SYMBOL_GPL(idle_cpu);
 
 /**
  * idle_task - return the idle task for a given cpu.
@@ -1013,8 +1013,9 @@ EXPORT_SYMBOL(radix_tree_gang_lookup_slot);
  * open-coding the search.
  */
 static unsigned int
-__lookup_tag(struct radix_tree_node *slot, void ***results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index, unsigned int tag)
+__lookup_tag(struct radix_tree_node *slot, void ***results,
+	unsigned long *indices, unsigned long index, unsigned int max_items,
+	unsigned long *next_index, unsigned int tag)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift, height;
@@ -1057,8 +1058,10 @@ __lookup_tag(struct radix_tree_node *slot, void ***results, unsigned long index,
 				 * rely on its value remaining the same).
 				 */
 				if (slot->slots[j]) {
-					results[nr_found++] = &(slot->slots[j]);
-					if (nr_found == max_items)
+					results[nr_found] = &(slot->slots[j]);
+					if (indices)
+						indices[nr_found] = index - 1;
+					if (++nr_found == max_items)
 						goto out;
 				}
 			}
@@ -1121,7 +1124,7 @@ radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup_tag(node, (void ***)results + ret,
+		slots_found = __lookup_tag(node, (void ***)results + ret, NULL,
 				cur_index, max_items - ret, &next_index, tag);
 		nr_found = 0;
 		for (i = 0; i < slots_found; i++) {
@@ -1148,6 +1151,7 @@ EXPORT_SYMBOL(radix_tree_gang_lookup_tag);
  *					  radix tree based on a tag
  *	@root:		radix tree root
  *	@results:	where the results of the lookup are placed
+ *	@indices:	where their indices should be placed (but usually NULL)
  *	@first_index:	start the lookup from this key
  *	@max_items:	place up to this many items at *results
  *	@tag:		the tag index (< RADIX_TREE_MAX_TAGS)
@@ -1158,8 +1162,8 @@ EXPORT_SYMBOL(radix_tree_gang_lookup_tag);
  */
 unsigned int
 radix_tree_gang_lookup_tag_slot(struct radix_tree_root *root, void ***results,
-		unsigned long first_index, unsigned int max_items,
-		unsigned int tag)
+		unsigned long *indices, unsigned long first_index,
+		unsigned int max_items, unsigned int tag)
 {
 	struct radix_tree_node *node;
 	unsigned long max_index;
@@ -1178,6 +1182,8 @@ radix_tree_gang_lookup_tag_slot(struct radix_tree_root *root, void ***results,
 		if (first_index > 0)
 			return 0;
 		results[0] = (void **)&root->rnode;
+		if (indices)
+			indices[0] = 0;
 		return 1;
 	}
 	node = indirect_to_ptr(node);
@@ -1192,6 +1198,7 @@ radix_tree_gang_lookup_tag_slot(struct radix_tree_root *root, void ***results,
 		if (cur_index > max_index)
 			break;
 		slots_found = __lookup_tag(node, results + ret,
+				indices ? indices + ret : NULL,
 				cur_index, max_items - ret, &next_index, tag);
 		ret += slots_found;
 		if (next_index == 0)
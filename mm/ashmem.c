@@ -27,6 +27,12 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/kref.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -36,8 +42,9 @@
 
 /*
  * ashmem_area - anonymous shared memory area
- * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Lifecycle: From our parent file's open() until its release(), or until the
+ *	shrinker drops the reference it took to purge one of its ranges
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
@@ -46,12 +53,15 @@ struct ashmem_area {
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	struct mutex mutex;		/* protects all of the above */
+	struct kref ref;		/* held by the file and the shrinker */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex'; the lru entry is protected by
+ *	`ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
@@ -62,18 +72,61 @@ struct ashmem_range {
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count, nothing else. The
+ * shrinker only picks ranges off the LRU under it and purges them under
+ * their area's mutex, so reclaim never holds up pinning in other areas.
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->mutex -> i_mutex -> i_alloc_sem
+ *		  asma->mutex -> ashmem_lru_lock
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* ranges the shrinker takes off the LRU before purging them */
+#define ASHMEM_SHRINK_BATCH	16
+
+/*
+ * Latency of the pin and unpin ioctls, including the wait for the area's
+ * mutex, as a log2 histogram in microseconds: bucket 0 counts calls under
+ * 1us and bucket i those under 2^i us, the last one taking all the rest.
+ */
+#define ASHMEM_LAT_BUCKETS	16
+
+struct ashmem_lat_stats {
+	unsigned long count;
+	u64 total_ns;
+	u64 max_ns;
+	unsigned long hist[ASHMEM_LAT_BUCKETS];
+};
+
+enum {
+	ASHMEM_STAT_PIN,
+	ASHMEM_STAT_UNPIN,
+	ASHMEM_STAT_NR,
+};
+
+static const char * const ashmem_stat_names[ASHMEM_STAT_NR] = {
+	"pin",
+	"unpin",
+};
+
+static DEFINE_PER_CPU(struct ashmem_lat_stats [ASHMEM_STAT_NR], ashmem_lat);
+
+/* shrinker activity, protected by ashmem_lru_lock */
+static struct {
+	unsigned long batches;
+	unsigned long purged_ranges;
+	unsigned long purged_pages;
+	unsigned long contended;
+} ashmem_shrink_stats;
+
+static struct dentry *ashmem_debugfs_dir;
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -104,14 +157,18 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /*
@@ -123,7 +180,7 @@ static inline void lru_del(struct ashmem_range *range)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
@@ -159,7 +216,7 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +226,20 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
+}
+
+static void ashmem_area_free(struct kref *ref)
+{
+	struct ashmem_area *asma = container_of(ref, struct ashmem_area, ref);
+
+	if (asma->file)
+		fput(asma->file);
+	kmem_cache_free(ashmem_area_cachep, asma);
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -187,6 +256,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
+	kref_init(&asma->ref);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -199,15 +270,12 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	if(!mutex_trylock(&ashmem_mutex))
-		return -1;
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
-	if (asma->file)
-		fput(asma->file);
-	kmem_cache_free(ashmem_area_cachep, asma);
+	kref_put(&asma->ref, ashmem_area_free);
 
 	return 0;
 }
@@ -218,7 +286,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -239,7 +307,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -248,7 +316,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -269,7 +337,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -286,7 +354,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -329,7 +397,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -345,12 +413,101 @@ out:
  * proceed without risk of deadlock (due to gfp_mask).
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * chunks of ashmem regions LRU-wise until we hit 'nr_to_scan' pages freed.
+ * Ranges are taken off the head of the LRU a batch at a time under
+ * ashmem_lru_lock, then truncated one by one under their area's mutex only.
+ * An area that is busy is skipped rather than waited for: we may be called
+ * from an allocation made with that very mutex held.
+ */
+struct ashmem_victim {
+	struct ashmem_area *asma;
+	struct ashmem_range *range;
+};
+
+/*
+ * ashmem_isolate_batch - picks up to ASHMEM_SHRINK_BATCH ranges, oldest
+ * first, adding up to about 'nr_to_scan' pages. Each area is pinned by a
+ * reference, and each range is rotated to the tail of the LRU so that one
+ * the shrinker has to skip is not picked again straight away.
  */
+static int ashmem_isolate_batch(struct ashmem_victim *batch, long nr_to_scan)
+{
+	struct ashmem_range *range;
+	int nr = 0;
+
+	spin_lock(&ashmem_lru_lock);
+	while (nr < ASHMEM_SHRINK_BATCH && nr_to_scan > 0 &&
+	       !list_empty(&ashmem_lru_list)) {
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		if (nr && range == batch[0].range)
+			break;
+		kref_get(&range->asma->ref);
+		batch[nr].asma = range->asma;
+		batch[nr].range = range;
+		nr++;
+		nr_to_scan -= range_size(range);
+		list_move_tail(&range->lru, &ashmem_lru_list);
+	}
+	if (nr)
+		ashmem_shrink_stats.batches++;
+	spin_unlock(&ashmem_lru_lock);
+
+	return nr;
+}
+
+/*
+ * ashmem_purge - purges the victim's range, if it is still unpinned, and
+ * returns the number of pages freed.
+ *
+ * The range may have been pinned and freed since it was picked, so it is
+ * looked up in its area's unpinned list before being touched.
+ */
+static unsigned long ashmem_purge(struct ashmem_victim *victim)
+{
+	struct ashmem_area *asma = victim->asma;
+	struct ashmem_range *range;
+	unsigned long freed = 0;
+
+	if (!mutex_trylock(&asma->mutex)) {
+		spin_lock(&ashmem_lru_lock);
+		ashmem_shrink_stats.contended++;
+		spin_unlock(&ashmem_lru_lock);
+		return 0;
+	}
+
+	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+		struct inode *inode;
+
+		if (range != victim->range)
+			continue;
+		if (!range_on_lru(range))
+			break;
+
+		inode = asma->file->f_dentry->d_inode;
+		vmtruncate_range(inode, range->pgstart * PAGE_SIZE,
+				 (range->pgend + 1) * PAGE_SIZE - 1);
+		range->purged = ASHMEM_WAS_PURGED;
+		freed = range_size(range);
+
+		spin_lock(&ashmem_lru_lock);
+		list_del(&range->lru);
+		lru_count -= freed;
+		ashmem_shrink_stats.purged_ranges++;
+		ashmem_shrink_stats.purged_pages += freed;
+		spin_unlock(&ashmem_lru_lock);
+		break;
+	}
+	mutex_unlock(&asma->mutex);
+
+	return freed;
+}
+
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_victim batch[ASHMEM_SHRINK_BATCH];
+	unsigned long freed;
+	int i, nr;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -358,21 +515,21 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+	while (sc->nr_to_scan > 0) {
+		nr = ashmem_isolate_batch(batch, sc->nr_to_scan);
+		if (!nr)
+			break;
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
+		freed = 0;
+		for (i = 0; i < nr; i++) {
+			freed += ashmem_purge(&batch[i]);
+			kref_put(&batch[i].asma->ref, ashmem_area_free);
+		}
+		/* everything left is pinned down by a busy area */
+		if (!freed)
 			break;
+		sc->nr_to_scan -= freed;
 	}
-	mutex_unlock(&ashmem_mutex);
 
 	return lru_count;
 }
@@ -386,7 +543,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -401,7 +558,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -409,7 +566,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -423,7 +580,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -432,7 +589,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -449,7 +606,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -458,7 +615,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -524,7 +681,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -559,7 +716,7 @@ restart:
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -579,12 +736,29 @@ static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 	return ret;
 }
 
+static void ashmem_account_latency(int stat, u64 start)
+{
+	struct ashmem_lat_stats *lat;
+	u64 delta = local_clock() - start;
+	unsigned long us = div_u64(delta, NSEC_PER_USEC);
+	int bucket = min_t(int, fls_long(us), ASHMEM_LAT_BUCKETS - 1);
+
+	lat = &get_cpu_var(ashmem_lat)[stat];
+	lat->count++;
+	lat->total_ns += delta;
+	if (delta > lat->max_ns)
+		lat->max_ns = delta;
+	lat->hist[bucket]++;
+	put_cpu_var(ashmem_lat);
+}
+
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 			    void __user *p)
 {
 	struct ashmem_pin pin;
 	size_t pgstart, pgend;
 	int ret = -EINVAL;
+	u64 start;
 
 	if (unlikely(!asma->file))
 		return -EINVAL;
@@ -608,7 +782,8 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	start = local_clock();
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -622,7 +797,12 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
+
+	if (cmd == ASHMEM_PIN)
+		ashmem_account_latency(ASHMEM_STAT_PIN, start);
+	else if (cmd == ASHMEM_UNPIN)
+		ashmem_account_latency(ASHMEM_STAT_UNPIN, start);
 
 	return ret;
 }
@@ -677,6 +857,59 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static int ashmem_stats_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_lat_stats sum;
+	int stat, cpu, i;
+
+	spin_lock(&ashmem_lru_lock);
+	seq_printf(m, "lru_pages: %lu\n", lru_count);
+	seq_printf(m, "shrink_batches: %lu\n", ashmem_shrink_stats.batches);
+	seq_printf(m, "purged_ranges: %lu\n",
+		   ashmem_shrink_stats.purged_ranges);
+	seq_printf(m, "purged_pages: %lu\n", ashmem_shrink_stats.purged_pages);
+	seq_printf(m, "purge_contended: %lu\n", ashmem_shrink_stats.contended);
+	spin_unlock(&ashmem_lru_lock);
+
+	for (stat = 0; stat < ASHMEM_STAT_NR; stat++) {
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			struct ashmem_lat_stats *lat;
+
+			lat = &per_cpu(ashmem_lat, cpu)[stat];
+			sum.count += lat->count;
+			sum.total_ns += lat->total_ns;
+			if (lat->max_ns > sum.max_ns)
+				sum.max_ns = lat->max_ns;
+			for (i = 0; i < ASHMEM_LAT_BUCKETS; i++)
+				sum.hist[i] += lat->hist[i];
+		}
+		seq_printf(m, "%s: count %lu avg %lluns max %lluns\n",
+			   ashmem_stat_names[stat], sum.count,
+			   sum.count ? div_u64(sum.total_ns, sum.count) : 0,
+			   sum.max_ns);
+		seq_printf(m, "  <1us: %lu\n", sum.hist[0]);
+		for (i = 1; i < ASHMEM_LAT_BUCKETS - 1; i++)
+			seq_printf(m, "  <%luus: %lu\n", 1UL << i, sum.hist[i]);
+		seq_printf(m, "  >=%luus: %lu\n", 1UL << (i - 1), sum.hist[i]);
+	}
+
+	return 0;
+}
+
+static int ashmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_stats_show, inode->i_private);
+}
+
+static const struct file_operations ashmem_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = ashmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -722,6 +955,11 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs_dir = debugfs_create_dir("ashmem", NULL);
+	if (ashmem_debugfs_dir)
+		debugfs_create_file("stats", S_IRUGO, ashmem_debugfs_dir,
+				    NULL, &ashmem_stats_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -731,6 +969,7 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	debugfs_remove_recursive(ashmem_debugfs_dir);
 	unregister_shrinker(&ashmem_shrinker);
 
 	ret = misc_deregister(&ashmem_misc);
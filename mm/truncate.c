@@ -22,6 +22,44 @@
 #include <linux/cleancache.h>
 #include "internal.h"
 
+/*
+ * Drop the shadow entries that page reclaim left for evicted pages in
+ * [start, end], so they don't outlive the file data they stand for.
+ */
+static void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long shadows[PAGEVEC_SIZE];
+	pgoff_t index = start;
+	unsigned int nr, nr_shadows, i;
+
+	while (index <= end) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		nr_shadows = 0;
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			void *entry = radix_tree_deref_slot_protected(slots[i],
+						&mapping->tree_lock);
+
+			if (radix_tree_exceptional_entry(entry))
+				shadows[nr_shadows++] = indices[i];
+		}
+		/* slots may be freed by a deletion: delete by index */
+		for (i = 0; i < nr_shadows; i++) {
+			radix_tree_delete(&mapping->page_tree, shadows[i]);
+			mapping->nrshadows--;
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+
+		if (!nr || indices[nr - 1] >= end || !mapping->nrshadows)
+			break;
+		index = indices[nr - 1] + 1;
+		cond_resched();
+	}
+}
 
 /**
  * do_invalidatepage - invalidate part or all of a page
@@ -214,7 +252,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -292,6 +330,8 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	if (mapping->nrshadows)
+		clear_shadow_entries(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -400,7 +440,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
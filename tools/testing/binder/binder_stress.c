@@ -0,0 +1,557 @@
+/*
+ * binder_stress - measure binder transaction scaling with concurrent pairs
+ *
+ * The parent becomes the context manager and acts as a tiny service
+ * manager. For each run it forks n server processes, which publish a
+ * node to it, and n client processes, which look their server up and
+ * then do synchronous ping-pong transactions with it, checking every
+ * reply. The pairs share nothing but the driver, so the calls/s column
+ * shows how well binder itself scales as pairs are added.
+ *
+ * The context manager can only be claimed once, so stop servicemanager
+ * (or run on a system without one) before running this.
+ *
+ * Usage: binder_stress [-p max_pairs] [-i iterations] [-s bytes]
+ *   -p  maximum number of client/server pairs (default: online CPUs / 2)
+ *   -i  calls made by each client per run (default: 10000)
+ *   -s  payload size of each call and reply in bytes (default: 32)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BINDER_DEV	"/dev/binder"
+#define MAP_SZ		(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_PAYLOAD	4096
+
+/* transaction codes understood by the parent */
+enum {
+	SM_REGISTER = 1,
+	SM_LOOKUP,
+	SM_DONE,
+};
+
+/* transaction codes understood by the servers */
+enum {
+	SRV_PING = 1,
+	SRV_QUIT,
+};
+
+struct sm_register {
+	long id;
+	struct flat_binder_object obj;
+};
+
+struct sm_lookup_reply {
+	long status;
+	struct flat_binder_object obj;
+};
+
+struct sm_done {
+	long id;
+	long calls;
+	long errors;
+	long long nsec;
+};
+
+struct bctx {
+	int fd;
+	void *map;
+};
+
+/* parent state */
+static uint32_t server_handle[MAX_PAIRS];
+static int run_pairs, lookups_ok, clients_done, start_fd = -1;
+static long total_calls, total_errors;
+static long long max_nsec;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bctx_open(struct bctx *b)
+{
+	struct binder_version vers;
+
+	b->fd = open(BINDER_DEV, O_RDWR);
+	if (b->fd < 0)
+		die(BINDER_DEV);
+	if (ioctl(b->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	b->map = mmap(NULL, MAP_SZ, PROT_READ, MAP_PRIVATE, b->fd, 0);
+	if (b->map == MAP_FAILED)
+		die("mmap");
+}
+
+static int bwrite(struct bctx *b, const void *data, size_t len)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)data;
+	while (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static int bread(struct bctx *b, void *buf, size_t len, size_t *got)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.read_size = len;
+	bwr.read_buffer = (unsigned long)buf;
+	while (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	*got = bwr.read_consumed;
+	return 0;
+}
+
+static void send_cmd(struct bctx *b, uint32_t cmd, const void *arg,
+		     size_t arg_len)
+{
+	char buf[sizeof(uint32_t) + sizeof(struct binder_transaction_data)];
+
+	memcpy(buf, &cmd, sizeof(cmd));
+	memcpy(buf + sizeof(cmd), arg, arg_len);
+	if (bwrite(b, buf, sizeof(cmd) + arg_len))
+		die("BINDER_WRITE_READ");
+}
+
+static void send_handle_cmd(struct bctx *b, uint32_t cmd, uint32_t handle)
+{
+	send_cmd(b, cmd, &handle, sizeof(handle));
+}
+
+static void free_buffer(struct bctx *b, const void *data)
+{
+	send_cmd(b, BC_FREE_BUFFER, &data, sizeof(data));
+}
+
+/* send a transaction or reply with at most one object at the given offset */
+static void send_txn(struct bctx *b, uint32_t cmd, uint32_t handle,
+		     unsigned int code, unsigned int flags,
+		     const void *data, size_t size, long obj_off)
+{
+	struct binder_transaction_data tr;
+	size_t off = obj_off;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.flags = flags;
+	tr.data_size = size;
+	tr.data.ptr.buffer = data;
+	if (obj_off >= 0) {
+		tr.offsets_size = sizeof(size_t);
+		tr.data.ptr.offsets = &off;
+	}
+	send_cmd(b, cmd, &tr, sizeof(tr));
+}
+
+typedef void (*txn_handler)(struct bctx *b, struct binder_transaction_data *tr);
+
+/*
+ * Read and act on one batch of return commands. Node reference requests
+ * are acknowledged, transactions are passed to the handler and a reply
+ * is copied to *reply. Returns 1 once a reply, or the transaction
+ * complete of a one-way call, has arrived, -1 on a failed call.
+ */
+static int handle_returns(struct bctx *b, txn_handler handler,
+			  struct binder_transaction_data *reply, int one_way)
+{
+	char buf[1024];
+	size_t got, pos = 0;
+	int done = 0;
+
+	if (bread(b, buf, sizeof(buf), &got))
+		die("BINDER_WRITE_READ");
+	while (pos + sizeof(uint32_t) <= got) {
+		uint32_t cmd;
+		void *arg;
+
+		memcpy(&cmd, buf + pos, sizeof(cmd));
+		pos += sizeof(cmd);
+		arg = buf + pos;
+		pos += _IOC_SIZE(cmd);
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_SPAWN_LOOPER:
+		case BR_RELEASE:
+		case BR_DECREFS:
+			break;
+		case BR_INCREFS:
+			send_cmd(b, BC_INCREFS_DONE, arg,
+				 sizeof(struct binder_ptr_cookie));
+			break;
+		case BR_ACQUIRE:
+			send_cmd(b, BC_ACQUIRE_DONE, arg,
+				 sizeof(struct binder_ptr_cookie));
+			break;
+		case BR_TRANSACTION_COMPLETE:
+			if (one_way)
+				done = 1;
+			break;
+		case BR_REPLY:
+			memcpy(reply, arg, sizeof(*reply));
+			done = 1;
+			break;
+		case BR_TRANSACTION:
+			handler(b, arg);
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+			done = -1;
+			break;
+		default:
+			fprintf(stderr, "%d: unexpected binder return %x\n",
+				getpid(), cmd);
+			exit(1);
+		}
+	}
+	return done;
+}
+
+static void no_handler(struct bctx *b, struct binder_transaction_data *tr)
+{
+	fprintf(stderr, "%d: unexpected incoming transaction\n", getpid());
+	exit(1);
+}
+
+/* synchronous call; the caller frees the reply buffer */
+static int call(struct bctx *b, uint32_t handle, unsigned int code,
+		const void *data, size_t size, long obj_off,
+		struct binder_transaction_data *reply)
+{
+	int ret;
+
+	send_txn(b, BC_TRANSACTION, handle, code, 0, data, size, obj_off);
+	while (!(ret = handle_returns(b, no_handler, reply, 0)))
+		;
+	return ret < 0 ? -1 : 0;
+}
+
+static void call_one_way(struct bctx *b, uint32_t handle, unsigned int code,
+			 const void *data, size_t size)
+{
+	send_txn(b, BC_TRANSACTION, handle, code, TF_ONE_WAY, data, size, -1);
+	while (!handle_returns(b, no_handler, NULL, 1))
+		;
+}
+
+static void sm_handler(struct bctx *b, struct binder_transaction_data *tr)
+{
+	const void *data = tr->data.ptr.buffer;
+	struct sm_lookup_reply lr;
+	long status = 0;
+
+	switch (tr->code) {
+	case SM_REGISTER: {
+		const struct sm_register *reg = data;
+
+		if (tr->data_size < sizeof(*reg) ||
+		    reg->obj.type != BINDER_TYPE_HANDLE ||
+		    reg->id < 0 || reg->id >= MAX_PAIRS) {
+			status = -1;
+			break;
+		}
+		/* keep the server's node alive once the buffer is freed */
+		send_handle_cmd(b, BC_ACQUIRE, reg->obj.handle);
+		server_handle[reg->id] = reg->obj.handle;
+		break;
+	}
+	case SM_LOOKUP: {
+		long id = *(const long *)data;
+
+		free_buffer(b, data);
+		memset(&lr, 0, sizeof(lr));
+		if (id < 0 || id >= MAX_PAIRS || !server_handle[id]) {
+			lr.status = 1;
+			send_txn(b, BC_REPLY, 0, 0, 0, &lr, sizeof(lr.status), -1);
+			return;
+		}
+		lr.obj.type = BINDER_TYPE_HANDLE;
+		lr.obj.handle = server_handle[id];
+		send_txn(b, BC_REPLY, 0, 0, 0, &lr, sizeof(lr),
+			 offsetof(struct sm_lookup_reply, obj));
+		/* every client has its server: let them go */
+		if (++lookups_ok == run_pairs && start_fd >= 0) {
+			close(start_fd);
+			start_fd = -1;
+		}
+		return;
+	}
+	case SM_DONE: {
+		const struct sm_done *d = data;
+
+		total_calls += d->calls;
+		total_errors += d->errors;
+		if (d->nsec > max_nsec)
+			max_nsec = d->nsec;
+		clients_done++;
+		free_buffer(b, data);
+		return;
+	}
+	default:
+		status = -1;
+	}
+	free_buffer(b, data);
+	send_txn(b, BC_REPLY, 0, 0, 0, &status, sizeof(status), -1);
+}
+
+static void server_handler(struct bctx *b, struct binder_transaction_data *tr)
+{
+	char reply[MAX_PAYLOAD];
+	size_t size = tr->data_size;
+
+	if (tr->code == SRV_QUIT)
+		exit(0);
+	if (size > sizeof(reply))
+		size = sizeof(reply);
+	memcpy(reply, tr->data.ptr.buffer, size);
+	free_buffer(b, tr->data.ptr.buffer);
+	send_txn(b, BC_REPLY, 0, 0, 0, reply, size, -1);
+}
+
+static void run_server(long id)
+{
+	struct binder_transaction_data reply;
+	struct sm_register reg;
+	struct bctx b;
+
+	bctx_open(&b);
+	memset(&reg, 0, sizeof(reg));
+	reg.id = id;
+	reg.obj.type = BINDER_TYPE_BINDER;
+	reg.obj.binder = (void *)(0x1000 + id);
+	reg.obj.cookie = (void *)(0x2000 + id);
+	if (call(&b, 0, SM_REGISTER, &reg, sizeof(reg),
+		 offsetof(struct sm_register, obj), &reply)) {
+		fprintf(stderr, "server %ld: register failed\n", id);
+		exit(1);
+	}
+	free_buffer(&b, reply.data.ptr.buffer);
+
+	send_cmd(&b, BC_ENTER_LOOPER, NULL, 0);
+	for (;;)
+		handle_returns(&b, server_handler, NULL, 0);
+}
+
+static void run_client(long id, int start_pipe, long iterations, size_t size)
+{
+	struct binder_transaction_data reply;
+	struct sm_done done;
+	uint32_t handle;
+	char data[MAX_PAYLOAD];
+	long long start;
+	struct bctx b;
+	long i;
+	char c;
+
+	bctx_open(&b);
+	for (;;) {
+		const struct sm_lookup_reply *lr;
+
+		if (call(&b, 0, SM_LOOKUP, &id, sizeof(id), -1, &reply)) {
+			fprintf(stderr, "client %ld: lookup failed\n", id);
+			exit(1);
+		}
+		lr = reply.data.ptr.buffer;
+		if (lr->status == 0) {
+			handle = lr->obj.handle;
+			send_handle_cmd(&b, BC_ACQUIRE, handle);
+			free_buffer(&b, lr);
+			break;
+		}
+		free_buffer(&b, lr);
+		usleep(1000);
+	}
+
+	/* wait for every client to be ready */
+	if (read(start_pipe, &c, 1) < 0)
+		die("read");
+
+	memset(&done, 0, sizeof(done));
+	memset(&reply, 0, sizeof(reply));
+	done.id = id;
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memset(data, (int)(i + id), size);
+		if (size >= sizeof(i))
+			memcpy(data, &i, sizeof(i));
+		if (call(&b, handle, SRV_PING, data, size, -1, &reply) ||
+		    reply.data_size != size ||
+		    memcmp(reply.data.ptr.buffer, data, size))
+			done.errors++;
+		else
+			done.calls++;
+		if (reply.data.ptr.buffer)
+			free_buffer(&b, reply.data.ptr.buffer);
+		memset(&reply, 0, sizeof(reply));
+	}
+	done.nsec = now_ns() - start;
+
+	call_one_way(&b, handle, SRV_QUIT, NULL, 0);
+	call_one_way(&b, 0, SM_DONE, &done, sizeof(done));
+	exit(0);
+}
+
+static int run(struct bctx *sm, int pairs, long iterations, size_t size,
+	       double *calls_per_sec)
+{
+	pid_t pids[2 * MAX_PAIRS];
+	int fds[2], i, status, ret = 0;
+
+	memset(server_handle, 0, sizeof(server_handle));
+	run_pairs = pairs;
+	lookups_ok = 0;
+	clients_done = 0;
+	total_calls = 0;
+	total_errors = 0;
+	max_nsec = 0;
+
+	if (pipe(fds))
+		die("pipe");
+	for (i = 0; i < 2 * pairs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			die("fork");
+		if (pids[i] == 0) {
+			/* the inherited fd is the parent's binder proc */
+			close(sm->fd);
+			close(fds[1]);
+			if (i < pairs)
+				run_server(i);
+			else
+				run_client(i - pairs, fds[0], iterations, size);
+		}
+	}
+	close(fds[0]);
+	start_fd = fds[1];
+
+	while (lookups_ok < pairs)
+		handle_returns(sm, sm_handler, NULL, 0);
+	while (clients_done < pairs)
+		handle_returns(sm, sm_handler, NULL, 0);
+
+	for (i = 0; i < 2 * pairs; i++) {
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+	for (i = 0; i < pairs; i++)
+		if (server_handle[i])
+			send_handle_cmd(sm, BC_RELEASE, server_handle[i]);
+
+	if (total_errors) {
+		fprintf(stderr, "%ld of %ld calls failed\n", total_errors,
+			total_errors + total_calls);
+		ret = -1;
+	}
+	*calls_per_sec = max_nsec ? total_calls * 1e9 / max_nsec : 0;
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p max_pairs] [-i iterations] "
+		"[-s bytes]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, n, max_pairs = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+	long iterations = 10000;
+	size_t size = 32;
+	double base = 0;
+	struct bctx sm;
+
+	while ((opt = getopt(argc, argv, "p:i:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			max_pairs = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atol(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || iterations < 1 || size > MAX_PAYLOAD)
+		usage(argv[0]);
+	if (max_pairs < 1)
+		max_pairs = 1;
+	if (max_pairs > MAX_PAIRS)
+		max_pairs = MAX_PAIRS;
+
+	bctx_open(&sm);
+	if (ioctl(sm.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		if (errno == EBUSY)
+			fprintf(stderr, "context manager already claimed, "
+				"stop servicemanager first\n");
+		else
+			perror("BINDER_SET_CONTEXT_MGR");
+		return 1;
+	}
+	send_cmd(&sm, BC_ENTER_LOOPER, NULL, 0);
+
+	printf("%8s %12s %10s %8s\n", "pairs", "calls/s", "usec/call",
+	       "scaling");
+	for (n = 1; n <= max_pairs; n++) {
+		double cps;
+
+		if (run(&sm, n, iterations, size, &cps) < 0)
+			return 1;
+		if (n == 1)
+			base = cps;
+		printf("%8d %12.0f %10.2f %7.2fx\n", n, cps,
+		       cps ? n * 1e6 / cps : 0, base ? cps / base : 0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * swapin_bench - measure swap-in latency of whatever swap is configured
+ *
+ * Runs itself in a memory cgroup whose limit is smaller than the buffer it
+ * fills, so that most of the buffer is pushed out to swap, then touches
+ * every page again in random order and times each access. Run it once with
+ * swap on a zram device and once with a swap device or file under a
+ * frontswap backend such as zcache (booted with "zcache"), to compare a
+ * compressed page coming back through the block layer with one handed back
+ * synchronously by frontswap_get_page().
+ *
+ * Usage: swapin_bench [-s mbytes] [-l mbytes] [-f fill] [-c memcg_dir]
+ *   -s  megabytes of anonymous memory to fill (default: 64)
+ *   -l  memory cgroup limit in megabytes (default: 16)
+ *   -f  percentage of each page filled with random bytes (default: 50),
+ *       the rest is a repeating pattern so pages compress to about 2:1
+ *   -c  where the memory cgroup hierarchy is mounted
+ *       (default: /sys/fs/cgroup/memory)
+ *
+ * The number of major faults, of pages read from swap devices (pswpin in
+ * /proc/vmstat) and of pages got from frontswap
+ * (/sys/kernel/mm/frontswap/succ_gets) during the timed pass is printed
+ * along with the latencies, to show which path served the faults. Set
+ * /proc/sys/vm/page-cluster to 0 to time single pages without readahead.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PAGE_SZ		4096
+
+static char memcg[300];
+static char memcg_root[256] = "/sys/fs/cgroup/memory";
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_file(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+	int ret = 0;
+
+	if (!f)
+		return -1;
+	if (fputs(val, f) < 0)
+		ret = -1;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+/* First number in 'path', or the value after 'key' if 'key' is given */
+static unsigned long long read_counter(const char *path, const char *key)
+{
+	unsigned long long val = 0;
+	char name[64] = "";
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return 0;
+	if (!key) {
+		if (fscanf(f, "%llu", &val) != 1)
+			val = 0;
+	} else {
+		while (fscanf(f, "%63s %llu", name, &val) == 2)
+			if (!strcmp(name, key))
+				break;
+		if (strcmp(name, key))
+			val = 0;
+	}
+	fclose(f);
+	return val;
+}
+
+static int enter_memcg(unsigned long limit_mb)
+{
+	char path[340], val[32];
+
+	snprintf(memcg, sizeof(memcg), "%s/swapin_bench.%d", memcg_root,
+		 getpid());
+	if (mkdir(memcg, 0755)) {
+		perror(memcg);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/memory.limit_in_bytes", memcg);
+	snprintf(val, sizeof(val), "%lu", limit_mb << 20);
+	if (write_file(path, val)) {
+		perror(path);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/tasks", memcg);
+	snprintf(val, sizeof(val), "%d", getpid());
+	if (write_file(path, val)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static void leave_memcg(void)
+{
+	char path[340], val[32];
+
+	if (!memcg[0])
+		return;
+	snprintf(path, sizeof(path), "%s/tasks", memcg_root);
+	snprintf(val, sizeof(val), "%d", getpid());
+	write_file(path, val);
+	rmdir(memcg);
+}
+
+static void fill_page(char *buf, int fill, unsigned int *seed)
+{
+	int i, rand_bytes = PAGE_SZ * fill / 100;
+
+	for (i = 0; i < rand_bytes; i++)
+		buf[i] = rand_r(seed);
+	for (; i < PAGE_SZ; i++)
+		buf[i] = i & 0x7;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s mbytes] [-l limit_mbytes] [-f fill] "
+		"[-c memcg_dir]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size_mb = 64, limit_mb = 16;
+	unsigned long long pswpin, fs_gets, t, total = 0, *lat;
+	unsigned int seed = 1;
+	int opt, fill = 50, ret = 1;
+	size_t i, pages, *order;
+	struct rusage ru0, ru1;
+	volatile char *buf;
+
+	while ((opt = getopt(argc, argv, "s:l:f:c:")) != -1) {
+		switch (opt) {
+		case 's':
+			size_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			limit_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fill = atoi(optarg);
+			break;
+		case 'c':
+			snprintf(memcg_root, sizeof(memcg_root), "%s", optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !size_mb || !limit_mb || limit_mb >= size_mb ||
+	    fill < 0 || fill > 100)
+		usage(argv[0]);
+
+	pages = (size_mb << 20) / PAGE_SZ;
+	lat = calloc(pages, sizeof(*lat));
+	order = calloc(pages, sizeof(*order));
+	buf = mmap(NULL, pages * PAGE_SZ, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!lat || !order || buf == MAP_FAILED) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if (enter_memcg(limit_mb))
+		goto out;
+
+	/* everything but the last limit_mb or so ends up in swap */
+	for (i = 0; i < pages; i++)
+		fill_page((char *)buf + i * PAGE_SZ, fill, &seed);
+
+	for (i = 0; i < pages; i++)
+		order[i] = i;
+	for (i = pages - 1; i > 0; i--) {
+		size_t j = rand_r(&seed) % (i + 1), tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	pswpin = read_counter("/proc/vmstat", "pswpin");
+	fs_gets = read_counter("/sys/kernel/mm/frontswap/succ_gets", NULL);
+	getrusage(RUSAGE_SELF, &ru0);
+
+	for (i = 0; i < pages; i++) {
+		t = now_ns();
+		buf[order[i] * PAGE_SZ]++;
+		lat[i] = now_ns() - t;
+		total += lat[i];
+	}
+
+	getrusage(RUSAGE_SELF, &ru1);
+	pswpin = read_counter("/proc/vmstat", "pswpin") - pswpin;
+	fs_gets = read_counter("/sys/kernel/mm/frontswap/succ_gets", NULL) -
+		  fs_gets;
+
+	qsort(lat, pages, sizeof(*lat), cmp_ull);
+	printf("%zu pages, %lu MB limit, %d%% random fill\n",
+	       pages, limit_mb, fill);
+	printf("major faults %ld, swap device reads %llu, frontswap gets %llu\n",
+	       ru1.ru_majflt - ru0.ru_majflt, pswpin, fs_gets);
+	printf("access latency us: avg %.2f p50 %.2f p90 %.2f p99 %.2f "
+	       "max %.2f\n", total / 1000.0 / pages,
+	       lat[pages / 2] / 1000.0, lat[pages * 90 / 100] / 1000.0,
+	       lat[pages * 99 / 100] / 1000.0, lat[pages - 1] / 1000.0);
+	ret = 0;
+out:
+	leave_memcg();
+	munmap((void *)buf, pages * PAGE_SZ);
+	free(order);
+	free(lat);
+	return ret;
+}
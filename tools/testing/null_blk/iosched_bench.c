@@ -0,0 +1,349 @@
+/*
+ * iosched_bench - measure the CPU cost per request of each I/O scheduler
+ *
+ * Meant to be run against a null_blk device (see
+ * Documentation/block/null_blk.txt), which completes requests without
+ * doing any I/O, so the CPU time the system spends is what the block layer
+ * and the elevator cost. For every elevator listed in
+ * /sys/block/<dev>/queue/scheduler, or only those given with -e, the
+ * device is switched to it and the same O_DIRECT load is run for a fixed
+ * time. The IOPS reached and the CPU time used per request, taken from
+ * /proc/stat over all CPUs, are printed per elevator. The original
+ * elevator is restored at the end.
+ *
+ * Usage: iosched_bench [-t threads] [-d seconds] [-b bytes] [-w percent]
+ *                      [-S] [-e elevator,...] /dev/nullbX
+ *   -t  number of submitting threads (default: number of online CPUs)
+ *   -d  seconds to run each elevator for (default: 5)
+ *   -b  bytes per request (default: 4096)
+ *   -w  percentage of requests that are writes (default: 0)
+ *   -S  sequential instead of random offsets, each thread in its own
+ *       region of the device, to give the elevators something to merge
+ *   -e  comma separated list of elevators to run
+ *
+ * The machine should be otherwise idle: CPU time is sampled system wide,
+ * since completions run in softirq and timer context on any CPU.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define MAX_ELEVATORS	16
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	uint64_t start;
+	uint64_t blocks;
+	unsigned int seed;
+	unsigned long ios;
+	int err;
+};
+
+static pthread_barrier_t barrier;
+static volatile int stop;
+
+static size_t block_size = 4096;
+static int write_pct;
+static int sequential;
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t next = 0;
+	char *buf;
+
+	if (posix_memalign((void **)&buf, 4096, block_size)) {
+		w->err = ENOMEM;
+		pthread_barrier_wait(&barrier);
+		return NULL;
+	}
+	memset(buf, 0x5a, block_size);
+
+	pthread_barrier_wait(&barrier);
+
+	while (!stop) {
+		uint64_t blk;
+		off_t off;
+		ssize_t ret;
+
+		if (sequential) {
+			blk = next++;
+			if (next == w->blocks)
+				next = 0;
+		} else {
+			blk = ((uint64_t)rand_r(&w->seed) << 31 |
+			       rand_r(&w->seed)) % w->blocks;
+		}
+		off = (w->start + blk) * block_size;
+
+		if ((int)(rand_r(&w->seed) % 100) < write_pct)
+			ret = pwrite(w->fd, buf, block_size, off);
+		else
+			ret = pread(w->fd, buf, block_size, off);
+		if (ret != (ssize_t)block_size) {
+			w->err = ret < 0 ? errno : EIO;
+			break;
+		}
+		w->ios++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* Busy and total jiffies of all CPUs, from the first line of /proc/stat */
+static int cpu_jiffies(unsigned long long *busy, unsigned long long *total)
+{
+	unsigned long long v[8] = { 0 };
+	FILE *f = fopen("/proc/stat", "r");
+	int i, n;
+
+	if (!f)
+		return -1;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+	fclose(f);
+	if (n < 4)
+		return -1;
+
+	*total = 0;
+	for (i = 0; i < 8; i++)
+		*total += v[i];
+	/* idle and iowait */
+	*busy = *total - v[3] - v[4];
+	return 0;
+}
+
+static int sysfs_read(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return -1;
+	if (!fgets(buf, len, f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static int sysfs_write(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+	int ret = 0;
+
+	if (!f)
+		return -1;
+	if (fputs(val, f) < 0)
+		ret = -1;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+/*
+ * Splits "noop deadline [cfq]" into its names and returns how many there
+ * are; the bracketed one, the current elevator, is copied to 'current'.
+ */
+static int parse_elevators(char *line, char **names, char *current,
+			   size_t len)
+{
+	char *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(line, " ", &save); tok && n < MAX_ELEVATORS;
+	     tok = strtok_r(NULL, " ", &save)) {
+		if (tok[0] == '[') {
+			tok++;
+			tok[strcspn(tok, "]")] = '\0';
+			snprintf(current, len, "%s", tok);
+		}
+		names[n++] = tok;
+	}
+	return n;
+}
+
+static int run(const char *dev, int nthreads, int seconds,
+	       uint64_t dev_blocks, double *iops, double *cpu_us)
+{
+	unsigned long long busy0, total0, busy1, total1;
+	unsigned long ios = 0;
+	struct worker *w;
+	int i, err = 0;
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		return -1;
+
+	stop = 0;
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		w[i].fd = open(dev, (write_pct ? O_RDWR : O_RDONLY) | O_DIRECT);
+		if (w[i].fd < 0) {
+			perror(dev);
+			exit(1);
+		}
+		if (sequential) {
+			w[i].blocks = dev_blocks / nthreads;
+			w[i].start = i * w[i].blocks;
+		} else {
+			w[i].blocks = dev_blocks;
+		}
+		w[i].seed = i + 1;
+		pthread_create(&w[i].thread, NULL, worker_fn, &w[i]);
+	}
+
+	pthread_barrier_wait(&barrier);
+	if (cpu_jiffies(&busy0, &total0))
+		err = errno;
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].thread, NULL);
+	if (cpu_jiffies(&busy1, &total1))
+		err = errno;
+
+	for (i = 0; i < nthreads; i++) {
+		if (w[i].err)
+			err = w[i].err;
+		ios += w[i].ios;
+		close(w[i].fd);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(w);
+
+	if (err) {
+		fprintf(stderr, "I/O error: %s\n", strerror(err));
+		return -1;
+	}
+
+	*iops = (double)ios / seconds;
+	*cpu_us = ios ? (busy1 - busy0) * 1e6 / sysconf(_SC_CLK_TCK) / ios : 0;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-d seconds] [-b bytes] "
+		"[-w write_percent] [-S] [-e elevator,...] /dev/nullbX\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, n, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = 5, ret = 0;
+	char *only = NULL, *dev, *names[MAX_ELEVATORS];
+	char sched_path[256], line[256], orig[64] = "";
+	uint64_t dev_bytes;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "t:d:b:w:Se:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_pct = atoi(optarg);
+			break;
+		case 'S':
+			sequential = 1;
+			break;
+		case 'e':
+			only = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nthreads < 1 || seconds < 1 ||
+	    !block_size || block_size % 512 || write_pct < 0 ||
+	    write_pct > 100)
+		usage(argv[0]);
+	dev = argv[optind];
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0 || ioctl(fd, BLKGETSIZE64, &dev_bytes)) {
+		perror(dev);
+		return 1;
+	}
+	close(fd);
+
+	snprintf(sched_path, sizeof(sched_path),
+		 "/sys/block/%s/queue/scheduler", basename(strdup(dev)));
+	if (sysfs_read(sched_path, line, sizeof(line))) {
+		perror(sched_path);
+		return 1;
+	}
+	n = parse_elevators(line, names, orig, sizeof(orig));
+	if (!orig[0]) {
+		/* a bio based device has no elevator to switch */
+		names[0] = "none";
+		n = 1;
+	}
+
+	printf("%d thread%s, %zu byte %s requests, %d%% writes, %d s each\n",
+	       nthreads, nthreads == 1 ? "" : "s", block_size,
+	       sequential ? "sequential" : "random", write_pct, seconds);
+	printf("%-12s %12s %14s\n", "elevator", "IOPS", "CPU us/request");
+
+	for (i = 0; i < n; i++) {
+		double iops, cpu_us;
+
+		if (only) {
+			char list[256], *tok, *save;
+			int found = 0;
+
+			snprintf(list, sizeof(list), "%s", only);
+			for (tok = strtok_r(list, ",", &save); tok;
+			     tok = strtok_r(NULL, ",", &save))
+				found |= !strcmp(tok, names[i]);
+			if (!found)
+				continue;
+		}
+		if (orig[0] && sysfs_write(sched_path, names[i])) {
+			fprintf(stderr, "can not switch to %s: %s\n",
+				names[i], strerror(errno));
+			ret = 1;
+			continue;
+		}
+
+		if (run(dev, nthreads, seconds, dev_bytes / block_size,
+			&iops, &cpu_us)) {
+			ret = 1;
+			break;
+		}
+		printf("%-12s %12.0f %14.2f\n", names[i], iops, cpu_us);
+		fflush(stdout);
+	}
+
+	if (orig[0])
+		sysfs_write(sched_path, orig);
+
+	return ret;
+}
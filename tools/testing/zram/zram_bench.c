@@ -0,0 +1,222 @@
+/*
+ * zram_bench - measure zram write/read scaling with concurrent writers
+ *
+ * Each thread owns a disjoint, page aligned region of the device and
+ * issues O_DIRECT page-sized I/O to it, the way kswapd and direct
+ * reclaim hit a zram swap device. The run is repeated for 1..N threads
+ * so the scaling of the compression path can be read off directly.
+ *
+ * Usage: zram_bench [-t max_threads] [-s mbytes] [-r] [-f fill] /dev/zramX
+ *   -t  maximum number of threads (default: number of online CPUs)
+ *   -s  megabytes written per run (default: 64)
+ *   -r  also time reading the data back
+ *   -f  percentage of each page filled with random bytes (default: 50),
+ *       the rest is a repeating pattern so pages compress to about 2:1
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SZ		4096
+/* pages each writer prepares up front and cycles through */
+#define POOL_PAGES	64
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	off_t start;
+	size_t pages;
+	int do_write;
+	int fill;
+	unsigned int seed;
+	int err;
+};
+
+static pthread_barrier_t barrier;
+
+static void fill_page(char *buf, int fill, unsigned int *seed)
+{
+	int i, rand_bytes = PAGE_SZ * fill / 100;
+
+	for (i = 0; i < rand_bytes; i++)
+		buf[i] = rand_r(seed);
+	for (; i < PAGE_SZ; i++)
+		buf[i] = i & 0x7;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	size_t i, pool = w->do_write ? POOL_PAGES : 1;
+	char *buf;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, pool * PAGE_SZ)) {
+		w->err = ENOMEM;
+		pthread_barrier_wait(&barrier);
+		return NULL;
+	}
+
+	/*
+	 * Generate the data outside the timed loop, so that the run
+	 * measures zram rather than rand_r().
+	 */
+	for (i = 0; i < pool; i++)
+		fill_page(buf + i * PAGE_SZ, w->fill, &w->seed);
+
+	pthread_barrier_wait(&barrier);
+
+	for (i = 0; i < w->pages; i++) {
+		off_t off = w->start + (off_t)i * PAGE_SZ;
+		char *page = buf + (i % pool) * PAGE_SZ;
+		ssize_t ret;
+
+		if (w->do_write) {
+			/* stamp the index so no two pages are identical */
+			memcpy(page, &off, sizeof(off));
+			ret = pwrite(w->fd, page, PAGE_SZ, off);
+		} else {
+			ret = pread(w->fd, page, PAGE_SZ, off);
+		}
+		if (ret != PAGE_SZ) {
+			w->err = ret < 0 ? errno : EIO;
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *dev, int nthreads, size_t total_pages,
+		  int do_write, int fill)
+{
+	struct worker *w;
+	size_t per_thread = total_pages / nthreads;
+	double start, elapsed;
+	int i, err = 0;
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		return -1;
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		w[i].fd = open(dev, (do_write ? O_WRONLY : O_RDONLY) | O_DIRECT);
+		if (w[i].fd < 0) {
+			perror(dev);
+			exit(1);
+		}
+		w[i].start = (off_t)i * per_thread * PAGE_SZ;
+		w[i].pages = per_thread;
+		w[i].do_write = do_write;
+		w[i].fill = fill;
+		w[i].seed = i + 1;
+		pthread_create(&w[i].thread, NULL, worker_fn, &w[i]);
+	}
+
+	pthread_barrier_wait(&barrier);
+	start = now();
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now() - start;
+
+	for (i = 0; i < nthreads; i++) {
+		if (w[i].err)
+			err = w[i].err;
+		close(w[i].fd);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(w);
+
+	if (err) {
+		fprintf(stderr, "I/O error: %s\n", strerror(err));
+		return -1;
+	}
+	return elapsed;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t max_threads] [-s mbytes] [-r] "
+		"[-f fill_percent] /dev/zramX\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, n, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int do_read = 0, fill = 50;
+	size_t mbytes = 64, total_pages;
+	double base = 0;
+
+	while ((opt = getopt(argc, argv, "t:s:rf:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			mbytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			do_read = 1;
+			break;
+		case 'f':
+			fill = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || max_threads < 1 || fill < 0 || fill > 100)
+		usage(argv[0]);
+
+	total_pages = mbytes * 1024 * 1024 / PAGE_SZ;
+
+	printf("%8s %12s %12s %8s", "threads", "write MB/s", "write IOPS",
+	       "scaling");
+	if (do_read)
+		printf(" %12s %12s", "read MB/s", "read IOPS");
+	printf("\n");
+
+	for (n = 1; n <= max_threads; n++) {
+		double t, mbs;
+
+		t = run(argv[optind], n, total_pages, 1, fill);
+		if (t < 0)
+			return 1;
+		mbs = mbytes / t;
+		if (n == 1)
+			base = mbs;
+		printf("%8d %12.1f %12.0f %7.2fx", n, mbs,
+		       total_pages / t, mbs / base);
+
+		if (do_read) {
+			t = run(argv[optind], n, total_pages, 0, fill);
+			if (t < 0)
+				return 1;
+			printf(" %12.1f %12.0f", mbytes / t, total_pages / t);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}